@@ -0,0 +1,332 @@
+//
+// Copyright (c) 2016 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _BRENT_H
+#define _BRENT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include "debug.h"
+#include "project.h"
+#include "sarray.h"
+
+namespace smt {
+
+//
+// Brent RP: Algorithms for Minimization without Derivatives. Prentice-Hall,
+// 1973, chapter 5.
+//
+// The univariate function is minimised in the interval [lower, upper] by a
+// combination of golden-section search and successive parabolic interpolation,
+// starting from the given point. The interval brackets the minimum at any time,
+// and the function object is never evaluated outside the bounds. The iteration
+// stops if the minimiser is known to within tol_rel*|x|+tol_abs.
+//
+
+template <typename float_t, typename function_t>
+class sBrent {
+public:
+	sBrent(const function_t& function):
+			_c(float_t(0.5)*(float_t(3)-std::sqrt(float_t(5)))),
+			_function(function),
+			_iter(0),
+			_f_calls(0) {
+	}
+
+	void init(const float_t& x, const float_t& lower, const float_t& upper) {
+		smt::assert(lower < upper);
+		_a = lower;
+		_b = upper;
+		_x = smt::project(x, _a, _b);
+		_fx = _function(_x);
+		_f_calls = 1;
+	}
+
+	bool solve(const float_t tol_rel = std::sqrt(std::numeric_limits<float_t>::epsilon()),
+			const float_t tol_abs = std::sqrt(std::numeric_limits<float_t>::epsilon()),
+			const std::size_t max_iter = 10000) {
+		_iter = 0;
+
+		float_t a = _a;
+		float_t b = _b;
+		float_t v = _x;
+		float_t w = _x;
+		float_t fv = _fx;
+		float_t fw = _fx;
+		float_t d = 0;
+		float_t e = 0;
+
+		bool converged = false;
+		while((! converged) && _iter < max_iter) {
+			const float_t m = float_t(0.5)*(a+b);
+			const float_t tol = tol_rel*std::abs(_x)+tol_abs;
+			const float_t tol2 = float_t(2)*tol;
+			if(std::abs(_x-m) <= tol2-float_t(0.5)*(b-a)) {
+				converged = true;
+				break;
+			}
+			++_iter;
+
+			bool golden = true;
+			if(std::abs(e) > tol) {
+				// parabolic interpolation through x, v and w
+				float_t r = (_x-w)*(_fx-fv);
+				float_t q = (_x-v)*(_fx-fw);
+				float_t p = (_x-v)*q-(_x-w)*r;
+				q = float_t(2)*(q-r);
+				if(q > float_t(0)) {
+					p = -p;
+				} else {
+					q = -q;
+				}
+				r = e;
+				e = d;
+				if(std::abs(p) < std::abs(float_t(0.5)*q*r) && p > q*(a-_x) && p < q*(b-_x)) {
+					d = p/q;
+					const float_t u = _x+d;
+					if(u-a < tol2 || b-u < tol2) {
+						d = (_x < m)? tol : -tol;
+					}
+					golden = false;
+				}
+			}
+			if(golden) {
+				e = ((_x < m)? b : a)-_x;
+				d = _c*e;
+			}
+
+			const float_t u = (std::abs(d) >= tol)? _x+d : ((d > float_t(0))? _x+tol : _x-tol);
+			const float_t fu = _function(smt::project(u, _a, _b));
+			_f_calls += 1;
+
+			if(fu <= _fx) {
+				if(u < _x) {
+					b = _x;
+				} else {
+					a = _x;
+				}
+				v = w;
+				fv = fw;
+				w = _x;
+				fw = _fx;
+				_x = u;
+				_fx = fu;
+			} else {
+				if(u < _x) {
+					a = u;
+				} else {
+					b = u;
+				}
+				if(fu <= fw || w == _x) {
+					v = w;
+					fv = fw;
+					w = u;
+					fw = fu;
+				} else if(fu <= fv || v == _x || v == w) {
+					v = u;
+					fv = fu;
+				}
+			}
+		}
+
+		return converged;
+	}
+
+	float_t operator()() const {
+		return smt::project(_x, _a, _b);
+	}
+
+	std::size_t iter() const {
+		return _iter;
+	}
+
+	std::size_t f_calls() const {
+		return _f_calls;
+	}
+
+	float_t fval() const {
+		return _fx;
+	}
+
+	~sBrent() {
+	}
+
+private:
+	const float_t _c;
+
+	const function_t& _function;
+
+	float_t _a;
+	float_t _b;
+	float_t _x;
+	float_t _fx;
+
+	std::size_t _iter;
+	std::size_t _f_calls;
+};
+
+// Bivariate function minimised in the box [lower, upper] by nested univariate
+// searches, i.e. the outer search minimises the profile
+//
+//   p(y0) = min_y1 f(y0, y1)
+//
+// and each profile value is computed by an inner search in y1, which is warm
+// started at the previous inner minimiser. The tolerances refer to the
+// function values as for the other solvers. Since f is quadratic near its
+// minimum, the variables are determined to within the square root of these,
+// relative to the extent of the box.
+
+template <typename float_t, typename function_t>
+class sProfileBrent {
+public:
+	sProfileBrent(const function_t& function):
+			_function(function),
+			_iter(0),
+			_f_calls(0) {
+	}
+
+	void init(const smt::sarray<float_t, 2>& x, const smt::sarray<float_t, 2>& lower, const smt::sarray<float_t, 2>& upper) {
+		for(std::size_t ii = 0; ii < 2; ++ii) {
+			smt::assert(lower(ii) < upper(ii));
+		}
+		_lower = lower;
+		_upper = upper;
+		for(std::size_t ii = 0; ii < 2; ++ii) {
+			_y(ii) = smt::project(x(ii), _lower(ii), _upper(ii));
+		}
+		_f_calls = 0;
+		_fval = std::numeric_limits<float_t>::max();
+	}
+
+	bool solve(const float_t tol_rel = 100*std::numeric_limits<float_t>::epsilon(),
+			const float_t tol_abs = std::numeric_limits<float_t>::epsilon(),
+			const std::size_t max_iter = 10000) {
+		_iter = 0;
+		_f_calls = 0;
+
+		const float_t tol = std::sqrt(std::max(tol_rel, tol_abs));
+		_tol_rel = std::sqrt(std::numeric_limits<float_t>::epsilon());
+		_tol_abs = tol*(_upper(1)-_lower(1));
+		_inner_converged = true;
+		_y1 = _y(1);
+
+		const Profile profile(*this);
+		smt::sBrent<float_t, Profile> outer(profile);
+		outer.init(_y(0), _lower(0), _upper(0));
+		const bool converged = outer.solve(_tol_rel, tol*(_upper(0)-_lower(0)), max_iter);
+		_iter = outer.iter();
+
+		return converged && _inner_converged;
+	}
+
+	smt::sarray<float_t, 2> operator()() const {
+		return _y;
+	}
+
+	std::size_t iter() const {
+		return _iter;
+	}
+
+	std::size_t f_calls() const {
+		return _f_calls;
+	}
+
+	float_t fval() const {
+		return _fval;
+	}
+
+	~sProfileBrent() {
+	}
+
+private:
+	// Cost function restricted to a line of constant y0, and the profile.
+
+	class Section {
+	public:
+		Section(const function_t& function, const float_t& y0): _function(function), _y0(y0) {
+		}
+
+		float_t operator()(const float_t& y1) const {
+			return _function(smt::sarray<float_t, 2>{_y0, y1});
+		}
+
+	private:
+		const function_t& _function;
+		const float_t _y0;
+	};
+
+	class Profile {
+	public:
+		Profile(sProfileBrent& solver): _solver(solver) {
+		}
+
+		float_t operator()(const float_t& y0) const {
+			return _solver.profile(y0);
+		}
+
+	private:
+		sProfileBrent& _solver;
+	};
+
+	float_t profile(const float_t& y0) {
+		const Section section(_function, y0);
+		smt::sBrent<float_t, Section> inner(section);
+		inner.init(_y1, _lower(1), _upper(1));
+		_inner_converged = inner.solve(_tol_rel, _tol_abs) && _inner_converged;
+		_f_calls += inner.f_calls();
+		_y1 = inner();
+		if(inner.fval() < _fval) {
+			_y(0) = y0;
+			_y(1) = _y1;
+			_fval = inner.fval();
+		}
+
+		return inner.fval();
+	}
+
+	const function_t& _function;
+
+	smt::sarray<float_t, 2> _lower;
+	smt::sarray<float_t, 2> _upper;
+
+	smt::sarray<float_t, 2> _y;
+	float_t _y1;
+	float_t _fval;
+
+	float_t _tol_rel;
+	float_t _tol_abs;
+	bool _inner_converged;
+
+	std::size_t _iter;
+	std::size_t _f_calls;
+};
+
+} // smt
+
+#endif // _BRENT_H
@@ -0,0 +1,114 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _CUMULANT_H
+#define _CUMULANT_H
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#include "shells.h"
+
+namespace smt {
+
+//
+// Second-order cumulant expansion of the spherical mean signal
+//
+//   log ybar_k = log s0 - b_k mean + b_k^2 var/2,
+//
+// where mean and var denote the mean and variance of the apparent diffusion
+// coefficient over all orientations and compartments. The expansion is fitted
+// by weighted least squares with weights n_k ybar_k^2, which accounts for the
+// logarithmic transform of the noise. At least three shells with positive mean
+// signal are required. The estimates are intended as a starting point of the
+// nonlinear optimisation only.
+//
+
+template <typename float_t>
+bool cumulant(const smt::shells<float_t>& shells, float_t& s0, float_t& mean, float_t& var) {
+	double A[3][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}};
+	std::size_t n = 0;
+	for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+		if(shells.mean(ii) > float_t(0)) {
+			const double bvalue = shells.bvalue(ii);
+			const double w = shells.count(ii)*double(shells.mean(ii))*shells.mean(ii);
+			const double a[4] = {1, -bvalue, 0.5*bvalue*bvalue, std::log(double(shells.mean(ii)))};
+			for(std::size_t jj = 0; jj < 3; ++jj) {
+				for(std::size_t kk = 0; kk < 4; ++kk) {
+					A[jj][kk] += w*a[jj]*a[kk];
+				}
+			}
+			++n;
+		}
+	}
+	if(n < 3) {
+		return false;
+	}
+
+	// Gaussian elimination with partial pivoting
+	for(std::size_t jj = 0; jj < 3; ++jj) {
+		std::size_t pp = jj;
+		for(std::size_t ii = jj+1; ii < 3; ++ii) {
+			if(std::abs(A[ii][jj]) > std::abs(A[pp][jj])) {
+				pp = ii;
+			}
+		}
+		if(! (std::abs(A[pp][jj]) > 0)) {
+			return false;
+		}
+		for(std::size_t kk = 0; kk < 4; ++kk) {
+			std::swap(A[jj][kk], A[pp][kk]);
+		}
+		for(std::size_t ii = jj+1; ii < 3; ++ii) {
+			const double c = A[ii][jj]/A[jj][jj];
+			for(std::size_t kk = jj; kk < 4; ++kk) {
+				A[ii][kk] -= c*A[jj][kk];
+			}
+		}
+	}
+	double x[3];
+	for(std::size_t jj = 3; jj-- > 0;) {
+		x[jj] = A[jj][3];
+		for(std::size_t kk = jj+1; kk < 3; ++kk) {
+			x[jj] -= A[jj][kk]*x[kk];
+		}
+		x[jj] /= A[jj][jj];
+	}
+
+	if(! (x[1] > 0)) {
+		return false;
+	}
+	s0 = std::exp(x[0]);
+	mean = x[1];
+	var = (x[2] > 0)? x[2] : 0;
+
+	return true;
+}
+
+} // smt
+
+#endif // _CUMULANT_H
@@ -64,10 +64,10 @@ void assert_noimpl() {}
 
 #define assert(test) assert_noimpl()
 #else
-void assert_impl(const bool& test, const std::string& s, const std::string& file, const long int& line, const std::string& function) {
+void assert_impl(const bool& test, const char* s, const char* file, const long int& line, const char* function) {
 	if(! test) {
 #ifdef mex_h
-		mexPrintAssertion(s.c_str(), file.c_str(), line.c_str(), nullptr);
+		mexPrintAssertion(s, file, line.c_str(), nullptr);
 #else
 		std::cerr << smt::colour::bold << smt::colour::red << "*** ERROR: " << smt::colour::reset << smt::colour::red << file << ":" << line << ": In function ‘" << function << "’: " << smt::colour::reset << smt::colour::bold << smt::colour::red << "Assertion ‘" << s << "’ failed." << smt::colour::reset << std::endl;
 		std::exit(EXIT_FAILURE);
@@ -0,0 +1,332 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _DICTIONARY_H
+#define _DICTIONARY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+
+#include "darray.h"
+#include "debug.h"
+#include "diffenc.h"
+#include "kdtree.h"
+#include "pow.h"
+#include "sarray.h"
+#include "shells.h"
+
+namespace smt {
+
+//
+// Dictionary of spherical mean signals for a given set of shells, sampled at
+// the cell centres of a regular n x n grid over two model parameters. The
+// shell signals of each atom are weighted by the square root of the number of
+// measurements per shell, such that Euclidean distances agree with the sum of
+// squares over all measurements. The voxel signal is matched to the closest
+// atom using a k-d tree, where atoms and voxel signal are normalised alike:
+//
+// If the signal scale is fixed by the mean zero b-value signal, the zero
+// b-value shells are excluded and the voxel signal is divided by their mean,
+// while the atoms have unit zero b-value signal by construction. Otherwise
+// atoms and voxel signal are normalised to unit length, which is invariant to
+// the scale, and the scale is the least-squares fit of the matched atom.
+//
+// The match may optionally be refined by interpolation between the atoms in
+// the neighbourhood of the matched atom, which may reach the bounds of the
+// model parameters rather than the outermost grid points.
+//
+
+template <typename float_t>
+class dictionary {
+public:
+	dictionary():
+			_fixed(false),
+			_n(0),
+			_k(0) {
+	}
+
+	dictionary(const smt::diffenc<float_t>& dw,
+			const bool& fixed,
+			const std::function<float_t(const float_t&, const float_t&, const float_t&)>& model,
+			const smt::sarray<float_t, 2>& xmin,
+			const smt::sarray<float_t, 2>& xmax,
+			const std::size_t& n = 100):
+				_shells(layout(dw)),
+				_fixed(fixed),
+				_model(model),
+				_xmin(xmin),
+				_xmax(xmax),
+				_n(n),
+				_k(nshells(_shells, fixed)),
+				_atoms(atoms()),
+				_tree(_atoms) {
+	}
+
+	explicit operator bool() const {
+		return _n > 0;
+	}
+
+	// Estimate of the two model parameters and the signal scale, which fails
+	// if the shells of the voxel differ from those of the dictionary.
+	bool operator()(const smt::darray<float_t, 1>& y, const smt::diffenc<float_t>& dw, smt::sarray<float_t, 3>& x, const bool& interpolate = false) const {
+		const smt::shells<float_t> sh(y, dw);
+		if(! compatible(sh)) {
+			return false;
+		}
+
+		const float_t y0 = (_fixed)? mean0(sh) : float_t(0);
+
+		smt::darray<float_t, 1> q(_k);
+		float_t norm = 0;
+		for(std::size_t ii = 0, kk = 0; ii < sh.size(); ++ii) {
+			if(! _fixed || sh.bvalue(ii) > float_t(0)) {
+				q(kk) = std::sqrt(float_t(sh.count(ii)))*sh.mean(ii);
+				norm += smt::pow2(q(kk));
+				++kk;
+			}
+		}
+		norm = (_fixed)? y0 : std::sqrt(norm);
+		if(! (norm > float_t(0))) {
+			return false;
+		}
+		for(std::size_t kk = 0; kk < _k; ++kk) {
+			q(kk) /= norm;
+		}
+
+		const std::size_t idx = _tree.nearest(q.begin());
+		const std::size_t i0 = idx/_n;
+		const std::size_t i1 = idx%_n;
+
+		const smt::sarray<float_t, 2> t = (interpolate)? refine(q, i0, i1) : smt::sarray<float_t, 2>{float_t(i0), float_t(i1)};
+		const smt::sarray<float_t, 2> p = param(t(0), t(1));
+		x(0) = p(0);
+		x(1) = p(1);
+
+		if(_fixed) {
+			x(2) = y0;
+		} else {
+			float_t num = 0;
+			float_t den = 0;
+			for(std::size_t ii = 0; ii < sh.size(); ++ii) {
+				const float_t s = _model(sh.bvalue(ii), p(0), p(1));
+				num += sh.count(ii)*sh.mean(ii)*s;
+				den += sh.count(ii)*s*s;
+			}
+			x(2) = num/den;
+		}
+
+		return true;
+	}
+
+	~dictionary() {
+	}
+
+private:
+	const smt::shells<float_t> _shells;
+	const bool _fixed;
+	const std::function<float_t(const float_t&, const float_t&, const float_t&)> _model;
+	const smt::sarray<float_t, 2> _xmin;
+	const smt::sarray<float_t, 2> _xmax;
+	const std::size_t _n;
+	const std::size_t _k;
+	const smt::darray<float_t, 2> _atoms;
+	const smt::kdtree<float_t> _tree;
+
+	static smt::shells<float_t> layout(const smt::diffenc<float_t>& dw) {
+		smt::darray<float_t, 1> y(dw.mapping.size());
+		std::fill(y.begin(), y.end(), float_t(0));
+
+		return smt::shells<float_t>(y, dw);
+	}
+
+	static std::size_t nshells(const smt::shells<float_t>& sh, const bool& fixed) {
+		std::size_t k = 0;
+		for(std::size_t ii = 0; ii < sh.size(); ++ii) {
+			if(! fixed || sh.bvalue(ii) > float_t(0)) {
+				++k;
+			}
+		}
+
+		return k;
+	}
+
+	smt::sarray<float_t, 2> param(const float_t& t0, const float_t& t1) const {
+		smt::sarray<float_t, 2> p;
+		p(0) = _xmin(0)+(t0+float_t(0.5))/_n*(_xmax(0)-_xmin(0));
+		p(1) = _xmin(1)+(t1+float_t(0.5))/_n*(_xmax(1)-_xmin(1));
+
+		return p;
+	}
+
+	// Normalised atom at the given model parameters.
+	template <typename iterator_t>
+	void atom(const smt::sarray<float_t, 2>& p, iterator_t a) const {
+		float_t norm = 0;
+		for(std::size_t ii = 0, kk = 0; ii < _shells.size(); ++ii) {
+			if(! _fixed || _shells.bvalue(ii) > float_t(0)) {
+				a[kk] = std::sqrt(float_t(_shells.count(ii)))*_model(_shells.bvalue(ii), p(0), p(1));
+				norm += smt::pow2(a[kk]);
+				++kk;
+			}
+		}
+		norm = (_fixed)? float_t(1) : std::sqrt(norm);
+		for(std::size_t kk = 0; kk < _k; ++kk) {
+			a[kk] /= norm;
+		}
+	}
+
+	smt::darray<float_t, 2> atoms() const {
+		smt::assert(_k > 0);
+
+		smt::darray<float_t, 2> a(_n*_n, _k);
+		for(std::size_t i0 = 0; i0 < _n; ++i0) {
+			for(std::size_t i1 = 0; i1 < _n; ++i1) {
+				atom(param(i0, i1), a.begin()+(i0*_n+i1)*_k);
+			}
+		}
+
+		return a;
+	}
+
+	// Squared distance between the voxel signal and the atom at fractional
+	// grid coordinates, which is evaluated by the model rather than by
+	// interpolation.
+	float_t cost(const smt::darray<float_t, 1>& q, const smt::sarray<float_t, 2>& t, smt::darray<float_t, 1>& a) const {
+		atom(param(t(0), t(1)), a.begin());
+		float_t c = 0;
+		for(std::size_t kk = 0; kk < _k; ++kk) {
+			c += smt::pow2(q(kk)-a(kk));
+		}
+
+		return c;
+	}
+
+	static float_t mean0(const smt::shells<float_t>& sh) {
+		float_t sum = 0;
+		std::size_t count = 0;
+		for(std::size_t ii = 0; ii < sh.size(); ++ii) {
+			if(sh.bvalue(ii) == float_t(0)) {
+				sum += sh.count(ii)*sh.mean(ii);
+				count += sh.count(ii);
+			}
+		}
+
+		return (count > 0)? sum/count : float_t(0);
+	}
+
+	bool compatible(const smt::shells<float_t>& sh) const {
+		if(sh.size() != _shells.size()) {
+			return false;
+		}
+		for(std::size_t ii = 0; ii < sh.size(); ++ii) {
+			if(sh.bvalue(ii) != _shells.bvalue(ii) || sh.count(ii) != _shells.count(ii)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Gauss-Newton refinement of the match, where the atoms are interpolated
+	// linearly between neighbouring grid points. The expansion point moves to
+	// the grid point closest to the estimate until the latter falls into its
+	// grid cell, which follows narrow valleys of the cost function. The steps
+	// are halved until the cost decreases, since the linearisation is nearly
+	// singular where the signal is insensitive to one of the parameters, e.g.
+	// along the isotropic ridge of the microscopic diffusion tensor model.
+	smt::sarray<float_t, 2> refine(const smt::darray<float_t, 1>& q, std::size_t i0, std::size_t i1) const {
+		smt::sarray<float_t, 2> t = {float_t(i0), float_t(i1)};
+		smt::darray<float_t, 1> a(_k);
+		float_t c = 0;
+		for(std::size_t kk = 0; kk < _k; ++kk) {
+			c += smt::pow2(q(kk)-_atoms(i0*_n+i1, kk));
+		}
+		for(std::size_t iter = 0; iter < 2*_n; ++iter) {
+			const std::size_t idx = i0*_n+i1;
+			const std::size_t lo0 = (i0 > 0)? i0-1 : i0;
+			const std::size_t hi0 = (i0+1 < _n)? i0+1 : i0;
+			const std::size_t lo1 = (i1 > 0)? i1-1 : i1;
+			const std::size_t hi1 = (i1+1 < _n)? i1+1 : i1;
+
+			float_t a00 = 0;
+			float_t a01 = 0;
+			float_t a11 = 0;
+			float_t g0 = 0;
+			float_t g1 = 0;
+			for(std::size_t kk = 0; kk < _k; ++kk) {
+				const float_t j0 = (_atoms(hi0*_n+i1, kk)-_atoms(lo0*_n+i1, kk))/float_t(hi0-lo0);
+				const float_t j1 = (_atoms(i0*_n+hi1, kk)-_atoms(i0*_n+lo1, kk))/float_t(hi1-lo1);
+				const float_t r = q(kk)-_atoms(idx, kk);
+				a00 += j0*j0;
+				a01 += j0*j1;
+				a11 += j1*j1;
+				g0 += j0*r;
+				g1 += j1*r;
+			}
+			const float_t det = a00*a11-a01*a01;
+			if(! (det > float_t(0))) {
+				break;
+			}
+			float_t d0 = (a11*g0-a01*g1)/det;
+			float_t d1 = (a00*g1-a01*g0)/det;
+
+			bool descent = false;
+			while(! descent && (std::abs(d0) > float_t(1)/_n || std::abs(d1) > float_t(1)/_n)) {
+				const smt::sarray<float_t, 2> u = {
+					std::min(std::max(i0+d0, float_t(-0.5)), float_t(_n)-float_t(0.5)),
+					std::min(std::max(i1+d1, float_t(-0.5)), float_t(_n)-float_t(0.5))};
+				const float_t cu = cost(q, u, a);
+				if(cu < c) {
+					t = u;
+					c = cu;
+					descent = true;
+				} else {
+					d0 /= float_t(2);
+					d1 /= float_t(2);
+				}
+			}
+			if(! descent || (std::abs(d0) <= float_t(1) && std::abs(d1) <= float_t(1))) {
+				break;
+			}
+
+			const std::size_t j0 = std::lround(std::min(std::max(t(0), float_t(0)), float_t(_n-1)));
+			const std::size_t j1 = std::lround(std::min(std::max(t(1), float_t(0)), float_t(_n-1)));
+			if(j0 == i0 && j1 == i1) {
+				break;
+			}
+			i0 = j0;
+			i1 = j1;
+		}
+
+		return t;
+	}
+};
+
+} // smt
+
+#endif // _DICTIONARY_H
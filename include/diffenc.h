@@ -85,6 +85,10 @@ public:
 	diffenc(const diffenc& rhs, const smt::sarray<float_t, 3, 3>& graddev):
 		diffenc(diffenc_graddev(rhs, graddev)) {}
 
+	template <typename T>
+	explicit diffenc(const diffenc<T>& rhs):
+		diffenc(diffenc_cast(rhs)) {}
+
 	explicit operator bool() const {
 		return (mapping)? true : false;
 	}
@@ -146,6 +150,21 @@ private:
 		return std::make_tuple(bvalues_, gradients_, mapping_);
 	}
 
+	template <typename T>
+	std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>> diffenc_cast(
+			const diffenc<T>& rhs) const {
+		smt::darray<float_t, 1> bvalues_(rhs.bvalues.size(0));
+		smt::darray<smt::sarray<float_t, 3>, 1> gradients_(rhs.gradients.size(0));
+		for(std::size_t ii = 0; ii < bvalues_.size(0); ++ii) {
+			bvalues_(ii) = rhs.bvalues(ii);
+			for(std::size_t jj = 0; jj < 3; ++jj) {
+				gradients_(ii)(jj) = rhs.gradients(ii)(jj);
+			}
+		}
+
+		return std::make_tuple(bvalues_, gradients_, smt::darray<std::size_t, 1>(rhs.mapping));
+	}
+
 	std::tuple<smt::darray<float_t, 1>, smt::darray<smt::sarray<float_t, 3>, 1>, smt::darray<std::size_t, 1>> diffenc_graddev(
 			const diffenc& rhs, const smt::sarray<float_t, 3, 3>& graddev) const {
 		const smt::sarray<float_t, 3, 3> id(smt::eye<float_t, 3, 3>());
@@ -27,9 +27,12 @@
 #ifndef _ENV_H
 #define _ENV_H
 
+#include <cstdint>
 #include <cstdlib>
 #include <string>
 
+#include <sys/stat.h>
+
 namespace smt {
 
 std::string getenv(const std::string& var) {
@@ -41,6 +44,23 @@ std::string getenv(const std::string& var) {
 	}
 }
 
+// Modification time of a file in seconds and nanoseconds since the epoch. The
+// nanoseconds are found in st_mtimespec on macOS and in st_mtim elsewhere, in
+// terms of which POSIX.1-2008 systems define st_mtime; otherwise they are zero.
+
+void mtime(const struct stat& st, std::int64_t& sec, std::int64_t& nsec) {
+#if defined(__APPLE__)
+	sec = st.st_mtimespec.tv_sec;
+	nsec = st.st_mtimespec.tv_nsec;
+#elif defined(st_mtime)
+	sec = st.st_mtim.tv_sec;
+	nsec = st.st_mtim.tv_nsec;
+#else
+	sec = st.st_mtime;
+	nsec = 0;
+#endif
+}
+
 } // smt
 
 #endif // _ENV_H
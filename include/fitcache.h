@@ -0,0 +1,200 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _FITCACHE_H
+#define _FITCACHE_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "darray.h"
+#include "diffenc.h"
+#include "sarray.h"
+#include "solver.h"
+
+namespace smt {
+
+// Key of a voxel fit, which comprises a hash of the (quantised) signal vector
+// and a hash of the diffusion encoding including the gradient deviation. With
+// 128 bits in total, collisions are negligible for any feasible image size.
+
+struct fitkey {
+	std::uint64_t signal = 0;
+	std::uint64_t encoding = 0;
+
+	bool operator==(const fitkey& rhs) const {
+		return signal == rhs.signal && encoding == rhs.encoding;
+	}
+};
+
+// Bounded memo of voxel estimates shared by the threads of smt::parfor, such
+// that voxels with identical data, e.g. padded or background regions, or
+// integer-valued measurements with duplicate low-signal vectors, are fitted
+// once. The entries are distributed over shards with a mutex each, and the
+// oldest entry of a shard is evicted when the shard is full. If quantum is
+// positive, the measurements are rounded to integer multiples of quantum
+// before hashing, which merges nearly identical signal vectors.
+
+template <typename float_t, unsigned int N>
+class fitcache {
+public:
+	fitcache(const std::size_t& capacity = 0, const float_t& quantum = 0):
+			_quantum(quantum),
+			_capacity((capacity+nshards-1)/nshards),
+			_shards((capacity > 0)? nshards : 0) {
+	}
+
+	explicit operator bool() const {
+		return ! _shards.empty();
+	}
+
+	// Hash of the diffusion encoding, which may be computed once for all voxels
+	// unless the gradient deviation varies.
+	std::uint64_t encoding(const smt::diffenc<float_t>& dw) const {
+		std::uint64_t h = seed;
+		for(std::size_t ii = 0; ii < dw.bvalues.size(); ++ii) {
+			h = mix(h, bits(dw.bvalues(ii)));
+			for(std::size_t jj = 0; jj < 3; ++jj) {
+				h = mix(h, bits(dw.gradients(ii)(jj)));
+			}
+		}
+		for(std::size_t ii = 0; ii < dw.mapping.size(); ++ii) {
+			h = mix(h, dw.mapping(ii));
+		}
+
+		return h;
+	}
+
+	fitkey key(const smt::darray<float_t, 1>& y, const std::uint64_t& encoding) const {
+		fitkey k;
+		k.signal = seed;
+		for(std::size_t ii = 0; ii < y.size(); ++ii) {
+			const float_t q = std::floor(y(ii)/_quantum+float_t(0.5));
+			if(_quantum > float_t(0) && std::isfinite(q) && q >= -qmax && q < qmax) {
+				k.signal = mix(k.signal, std::uint64_t(std::int64_t(q)));
+			} else {
+				k.signal = mix(k.signal, bits(y(ii)));
+			}
+		}
+		k.encoding = encoding;
+
+		return k;
+	}
+
+	fitkey key(const smt::darray<float_t, 1>& y, const smt::diffenc<float_t>& dw) const {
+		return key(y, encoding(dw));
+	}
+
+	bool find(const fitkey& k, smt::sarray<float_t, N>& x, smt::optinfo<float_t>& info) const {
+		const shard& s = _shards[k.signal % nshards];
+		std::lock_guard<std::mutex> lock(s.mutex);
+		const auto it = s.entries.find(k);
+		if(it != s.entries.end()) {
+			x = it->second.x;
+			info = it->second.info;
+
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	void insert(const fitkey& k, const smt::sarray<float_t, N>& x, const smt::optinfo<float_t>& info) {
+		shard& s = _shards[k.signal % nshards];
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if(s.entries.count(k) == 0) {
+			if(s.entries.size() >= _capacity) {
+				s.entries.erase(s.order.front());
+				s.order.pop_front();
+			}
+			s.entries.emplace(k, entry{x, info});
+			s.order.push_back(k);
+		}
+	}
+
+	~fitcache() {
+	}
+
+private:
+	static const std::size_t nshards = 64;
+	static const std::uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+	// Bound of the quantised measurements representable as std::int64_t, i.e.
+	// 2^63. Measurements beyond, infinities and NaNs are hashed unquantised.
+	static constexpr float_t qmax = 9223372036854775808.0;
+
+	struct entry {
+		smt::sarray<float_t, N> x;
+		smt::optinfo<float_t> info;
+	};
+
+	struct hash {
+		std::size_t operator()(const fitkey& k) const {
+			return k.signal^(k.encoding*0xff51afd7ed558ccdull);
+		}
+	};
+
+	struct shard {
+		mutable std::mutex mutex;
+		std::unordered_map<fitkey, entry, hash> entries;
+		std::deque<fitkey> order;
+	};
+
+	const float_t _quantum;
+	const std::size_t _capacity;
+	std::vector<shard> _shards;
+
+	// Bit pattern of a floating-point number, where zeros of either sign map
+	// to the same pattern.
+	static std::uint64_t bits(const float_t& x) {
+		std::uint64_t b = 0;
+		if(x != float_t(0)) {
+			std::memcpy(&b, &x, sizeof(x));
+		}
+
+		return b;
+	}
+
+	// Combination of a hash value with a 64-bit word by the finaliser of
+	// splitmix64.
+	static std::uint64_t mix(std::uint64_t h, const std::uint64_t& w) {
+		h ^= w+seed+(h << 6)+(h >> 2);
+		h = (h^(h >> 30))*0xbf58476d1ce4e5b9ull;
+		h = (h^(h >> 27))*0x94d049bb133111ebull;
+
+		return h^(h >> 31);
+	}
+};
+
+} // smt
+
+#endif // _FITCACHE_H
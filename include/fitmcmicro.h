@@ -27,17 +27,24 @@
 #ifndef _FITMCMICRO_H
 #define _FITMCMICRO_H
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <vector>
 
+#include "cumulant.h"
 #include "darray.h"
 #include "debug.h"
+#include "dictionary.h"
 #include "diffenc.h"
 #include "logit.h"
 #include "meansignal.h"
-#include "neldermead.h"
+#include "neldermeadlockstep.h"
 #include "pow.h"
 #include "project.h"
 #include "sarray.h"
+#include "shells.h"
+#include "solver.h"
 
 namespace smt {
 
@@ -49,31 +56,107 @@ namespace smt {
 //   Magnetic Resonance in Medicine, p. 1078, 2016.
 //
 
+// Intra-neurite volume fraction and diffusivity matching the mean and variance
+// of the apparent diffusion coefficient, see cumulant.h. With the tortuosity
+// model, the squared coefficient of variation depends on the volume fraction
+// only and increases monotonically from 0 to 4/5, hence the volume fraction is
+// found by bisection. The estimates are projected into the interior of the
+// admissible range.
+
+template <typename float_t>
+smt::sarray<float_t, 2> mcmicromoments(const float_t& mean, const float_t& var, const float_t& diffmax) {
+	// first and second moment for unit diffusivity
+	const auto moment1 = [](const float_t& intra) {
+		return intra/float_t(3)+(float_t(1)-intra)*((float_t(1)-intra)+intra/float_t(3));
+	};
+	const auto moment2 = [](const float_t& intra) {
+		return intra/float_t(5)+(float_t(1)-intra)*(smt::pow2(float_t(1)-intra)+float_t(2)/float_t(3)*(float_t(1)-intra)*intra+smt::pow2(intra)/float_t(5));
+	};
+
+	const float_t cv2 = var/smt::pow2(mean);
+	float_t lo = 0;
+	float_t hi = 1;
+	for(std::size_t ii = 0; ii < 30; ++ii) {
+		const float_t intra = float_t(0.5)*(lo+hi);
+		if(moment2(intra)/smt::pow2(moment1(intra))-float_t(1) < cv2) {
+			lo = intra;
+		} else {
+			hi = intra;
+		}
+	}
+	smt::sarray<float_t, 2> x;
+	x(0) = smt::project(float_t(0.5)*(lo+hi), float_t(0.01), float_t(0.99));
+	x(1) = smt::project(mean/moment1(x(0)), float_t(0.01)*diffmax, float_t(0.99)*diffmax);
+
+	return x;
+}
+
 template <typename float_t>
 class McMicroFunction {
 public:
 	McMicroFunction(const smt::darray<float_t, 1>& y,
 			const smt::diffenc<float_t>& dw,
-			const float_t& diffmax = 3.05e-3):
-				_y(y),
-				_dw(dw),
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_shells(y, dw),
 				_intramax(1),
 				_diffmax(diffmax),
-				_y0(mean(y, dw)) {
+				_approx(approx),
+				_y0(mean(y, dw)),
+				_sumsq(sumsq(_shells)),
+				_intrasignal(_shells.size()),
+				_extrasignal(_shells.size()) {
 	}
 
 	float_t operator()(const smt::sarray<float_t, 2>& x) const {
+		return value(trans(x));
+	}
+
+	// Cost function value in terms of the model parameters, which allows
+	// solvers with simple bounds, see lower() and upper().
+	float_t value(const smt::sarray<float_t, 2>& y) const {
+		const float_t intra = y(0);
+		const float_t diff = y(1);
+		meansignal(diff, float_t(0), _intrasignal);
+		meansignal(diff, tortuosity(intra)*diff, _extrasignal);
+		float_t fval = _sumsq;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			if(_shells.bvalue(ii) > float_t(0)) {
+				fval += _shells.count(ii)*smt::pow2(_shells.mean(ii)-_y0*(intra*_intrasignal(ii)+(float_t(1)-intra)*_extrasignal(ii)));
+			}
+		}
+
+		return fval;
+	}
+
+	std::size_t residuals() const {
+		std::size_t n = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			if(_shells.bvalue(ii) > float_t(0)) {
+				++n;
+			}
+		}
+
+		return n;
+	}
+
+	void jacobian(const smt::sarray<float_t, 2>& x, smt::darray<float_t, 1>& r, smt::darray<smt::sarray<float_t, 2>, 1>& J) const {
 		const float_t intra = smt::expit(x(0), _intramax);
 		const float_t diff = smt::expit(x(1), _diffmax);
-		float_t fval = 0;
-		for(std::size_t ii = 0; ii < _dw.mapping.size(); ++ii) {
-			const float_t bvalue = _dw.bvalues(_dw.mapping(ii));
+		const float_t dintra = smt::dexpit(x(0), _intramax);
+		const float_t ddiff = smt::dexpit(x(1), _diffmax);
+		std::size_t kk = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t bvalue = _shells.bvalue(ii);
 			if(bvalue > float_t(0)) {
-				fval += smt::pow2(_y(ii)-_y0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+				const float_t w = std::sqrt(float_t(_shells.count(ii)));
+				const smt::sarray<float_t, 2> ds = dsignal(bvalue, intra, diff);
+				r(kk) = w*(_shells.mean(ii)-_y0*signal(bvalue, intra, diff));
+				J(kk)(0) = -w*_y0*ds(0)*dintra;
+				J(kk)(1) = -w*_y0*ds(1)*ddiff;
+				++kk;
 			}
 		}
-
-		return fval;
 	}
 
 	smt::sarray<float_t, 2> init() const {
@@ -81,6 +164,17 @@ public:
 		x0(0) = smt::logit(float_t(0.5)*_intramax, _intramax);
 		x0(1) = smt::logit(float_t(0.5)*_diffmax, _diffmax);
 
+		float_t s0 = 0;
+		float_t mean = 0;
+		float_t var = 0;
+		if(smt::cumulant(_shells, s0, mean, var)) {
+			const smt::sarray<float_t, 2> x = smt::mcmicromoments(mean, var, _diffmax);
+			const smt::sarray<float_t, 2> x1 = init(x);
+			if(operator()(x1) < operator()(x0)) {
+				return x1;
+			}
+		}
+
 		return x0;
 	}
 
@@ -92,6 +186,19 @@ public:
 		return x0;
 	}
 
+	bool admissible(const smt::sarray<float_t, 2>& x) const {
+		return x(0) > float_t(0) && x(0) < _intramax &&
+				x(1) > float_t(0) && x(1) < _diffmax;
+	}
+
+	smt::sarray<float_t, 2> lower() const {
+		return smt::sarray<float_t, 2>{smt::logit_lower(_intramax), smt::logit_lower(_diffmax)};
+	}
+
+	smt::sarray<float_t, 2> upper() const {
+		return smt::sarray<float_t, 2>{smt::logit_upper(_intramax), smt::logit_upper(_diffmax)};
+	}
+
 	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
 		smt::sarray<float_t, 2> y;
 		y(0) = smt::expit(x(0), _intramax);
@@ -109,20 +216,66 @@ public:
 		return y;
 	}
 
+	const smt::shells<float_t>& shells() const {
+		return _shells;
+	}
+
+	float_t y0() const {
+		return _y0;
+	}
+
+	float_t sumsq() const {
+		return _sumsq;
+	}
+
 	~McMicroFunction() {
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
-	const smt::diffenc<float_t> _dw;
+	const smt::shells<float_t> _shells;
 	const float_t _intramax;
 	const float_t _diffmax;
+	const bool _approx;
 	const float_t _y0;
+	const float_t _sumsq;
+	mutable smt::darray<float_t, 1> _intrasignal;
+	mutable smt::darray<float_t, 1> _extrasignal;
+
+	float_t meansignal(const float_t& bvalue, const float_t& lambda1, const float_t& lambda2) const {
+		if(_approx) {
+			return smt::meansignal_approx(bvalue, lambda1, lambda2);
+		} else {
+			return smt::meansignal(bvalue, lambda1, lambda2);
+		}
+	}
+
+	void meansignal(const float_t& lambda1, const float_t& lambda2, smt::darray<float_t, 1>& s) const {
+		if(_approx) {
+			smt::meansignal_approx(_shells.bvalues(), lambda1, lambda2, s);
+		} else {
+			smt::meansignal(_shells.bvalues(), lambda1, lambda2, s);
+		}
+	}
 
 	float_t tortuosity(const float_t& intra) const {
 		return float_t(1)-smt::project(intra, float_t(0), _intramax);
 	}
 
+	float_t signal(const float_t& bvalue, const float_t& intra, const float_t& diff) const {
+		return intra*meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*meansignal(bvalue, diff, tortuosity(intra)*diff);
+	}
+
+	smt::sarray<float_t, 2> dsignal(const float_t& bvalue, const float_t& intra, const float_t& diff) const {
+		const float_t tort = tortuosity(intra);
+		const smt::sarray<float_t, 2> ds_intra = smt::dmeansignal(bvalue, diff, float_t(0));
+		const smt::sarray<float_t, 2> ds_extra = smt::dmeansignal(bvalue, diff, tort*diff);
+		smt::sarray<float_t, 2> ds;
+		ds(0) = meansignal(bvalue, diff, float_t(0))-meansignal(bvalue, diff, tort*diff)-(float_t(1)-intra)*ds_extra(1)*diff;
+		ds(1) = intra*ds_intra(0)+(float_t(1)-intra)*(ds_extra(0)+ds_extra(1)*tort);
+
+		return ds;
+	}
+
 	float_t mean(const smt::darray<float_t, 1>& y, const smt::diffenc<float_t>& dw) const {
 		float_t y0 = 0;
 		std::size_t n = 0;
@@ -137,6 +290,17 @@ private:
 
 		return y0;
 	}
+
+	float_t sumsq(const smt::shells<float_t>& shells) const {
+		float_t sumsq = 0;
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			if(shells.bvalue(ii) > float_t(0)) {
+				sumsq += shells.sumsq(ii);
+			}
+		}
+
+		return sumsq;
+	}
 };
 
 template <typename float_t>
@@ -144,31 +308,76 @@ class McMicro0Function {
 public:
 	McMicro0Function(const smt::darray<float_t, 1>& y,
 			const smt::diffenc<float_t>& dw,
-			const float_t& diffmax = 3.05e-3):
-				_y(y),
-				_dw(dw),
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_shells(y, dw),
 				_intramax(1),
-				_diffmax(diffmax) {
+				_diffmax(diffmax),
+				_approx(approx),
+				_ymax(maxsignal(y)),
+				_sumsq(sumsq(_shells)),
+				_intrasignal(_shells.size()),
+				_extrasignal(_shells.size()) {
 	}
 
 	float_t operator()(const smt::sarray<float_t, 3>& x) const {
+		return value(trans(x));
+	}
+
+	// Cost function value in terms of the model parameters, which allows
+	// solvers with simple bounds, see lower() and upper().
+	float_t value(const smt::sarray<float_t, 3>& y) const {
+		const float_t intra = y(0);
+		const float_t diff = y(1);
+		const float_t e0 = y(2);
+		meansignal(diff, float_t(0), _intrasignal);
+		meansignal(diff, tortuosity(intra)*diff, _extrasignal);
+		float_t fval = _sumsq;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			fval += _shells.count(ii)*smt::pow2(_shells.mean(ii)-e0*(intra*_intrasignal(ii)+(float_t(1)-intra)*_extrasignal(ii)));
+		}
+
+		return fval;
+	}
+
+	std::size_t residuals() const {
+		return _shells.size();
+	}
+
+	void jacobian(const smt::sarray<float_t, 3>& x, smt::darray<float_t, 1>& r, smt::darray<smt::sarray<float_t, 3>, 1>& J) const {
 		const float_t intra = smt::expit(x(0), _intramax);
 		const float_t diff = smt::expit(x(1), _diffmax);
+		const float_t dintra = smt::dexpit(x(0), _intramax);
+		const float_t ddiff = smt::dexpit(x(1), _diffmax);
 		const float_t e0 = std::exp(x(2));
-		float_t fval = 0;
-		for(std::size_t ii = 0; ii < _dw.mapping.size(); ++ii) {
-			const float_t bvalue = _dw.bvalues(_dw.mapping(ii));
-			fval += smt::pow2(_y(ii)-e0*(intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, tortuosity(intra)*diff)));
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t bvalue = _shells.bvalue(ii);
+			const float_t w = std::sqrt(float_t(_shells.count(ii)));
+			const float_t s = signal(bvalue, intra, diff);
+			const smt::sarray<float_t, 2> ds = dsignal(bvalue, intra, diff);
+			r(ii) = w*(_shells.mean(ii)-e0*s);
+			J(ii)(0) = -w*e0*ds(0)*dintra;
+			J(ii)(1) = -w*e0*ds(1)*ddiff;
+			J(ii)(2) = -w*e0*s;
 		}
-
-		return fval;
 	}
 
 	smt::sarray<float_t, 3> init() const {
 		smt::sarray<float_t, 3> x0;
 		x0(0) = smt::logit(float_t(0.5)*_intramax, _intramax);
 		x0(1) = smt::logit(float_t(0.5)*_diffmax, _diffmax);
-		x0(2) = std::log(maxsignal());
+		x0(2) = std::log(_ymax);
+
+		float_t s0 = 0;
+		float_t mean = 0;
+		float_t var = 0;
+		if(smt::cumulant(_shells, s0, mean, var)) {
+			const smt::sarray<float_t, 2> x = smt::mcmicromoments(mean, var, _diffmax);
+			const smt::sarray<float_t, 3> x1 = init(smt::sarray<float_t, 3>{x(0), x(1), s0});
+			if(operator()(x1) < operator()(x0)) {
+				return x1;
+			}
+		}
 
 		return x0;
 	}
@@ -182,6 +391,20 @@ public:
 		return x0;
 	}
 
+	bool admissible(const smt::sarray<float_t, 3>& x) const {
+		return x(0) > float_t(0) && x(0) < _intramax &&
+				x(1) > float_t(0) && x(1) < _diffmax &&
+				x(2) > float_t(0);
+	}
+
+	smt::sarray<float_t, 3> lower() const {
+		return smt::sarray<float_t, 3>{smt::logit_lower(_intramax), smt::logit_lower(_diffmax), smt::logit_lower(smax())};
+	}
+
+	smt::sarray<float_t, 3> upper() const {
+		return smt::sarray<float_t, 3>{smt::logit_upper(_intramax), smt::logit_upper(_diffmax), smax()};
+	}
+
 	smt::sarray<float_t, 3> trans(const smt::sarray<float_t, 3>& x) const {
 		smt::sarray<float_t, 3> y;
 		y(0) = smt::expit(x(0), _intramax);
@@ -195,54 +418,544 @@ public:
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
-	const smt::diffenc<float_t> _dw;
+	const smt::shells<float_t> _shells;
 	const float_t _intramax;
 	const float_t _diffmax;
+	const bool _approx;
+	const float_t _ymax;
+	const float_t _sumsq;
+	mutable smt::darray<float_t, 1> _intrasignal;
+	mutable smt::darray<float_t, 1> _extrasignal;
+
+	float_t meansignal(const float_t& bvalue, const float_t& lambda1, const float_t& lambda2) const {
+		if(_approx) {
+			return smt::meansignal_approx(bvalue, lambda1, lambda2);
+		} else {
+			return smt::meansignal(bvalue, lambda1, lambda2);
+		}
+	}
+
+	void meansignal(const float_t& lambda1, const float_t& lambda2, smt::darray<float_t, 1>& s) const {
+		if(_approx) {
+			smt::meansignal_approx(_shells.bvalues(), lambda1, lambda2, s);
+		} else {
+			smt::meansignal(_shells.bvalues(), lambda1, lambda2, s);
+		}
+	}
 
 	float_t tortuosity(const float_t& intra) const {
 		return float_t(1)-smt::project(intra, float_t(0), _intramax);
 	}
 
-	float_t maxsignal() const {
+	float_t signal(const float_t& bvalue, const float_t& intra, const float_t& diff) const {
+		return intra*meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*meansignal(bvalue, diff, tortuosity(intra)*diff);
+	}
+
+	smt::sarray<float_t, 2> dsignal(const float_t& bvalue, const float_t& intra, const float_t& diff) const {
+		const float_t tort = tortuosity(intra);
+		const smt::sarray<float_t, 2> ds_intra = smt::dmeansignal(bvalue, diff, float_t(0));
+		const smt::sarray<float_t, 2> ds_extra = smt::dmeansignal(bvalue, diff, tort*diff);
+		smt::sarray<float_t, 2> ds;
+		ds(0) = meansignal(bvalue, diff, float_t(0))-meansignal(bvalue, diff, tort*diff)-(float_t(1)-intra)*ds_extra(1)*diff;
+		ds(1) = intra*ds_intra(0)+(float_t(1)-intra)*(ds_extra(0)+ds_extra(1)*tort);
+
+		return ds;
+	}
+
+	float_t smax() const {
+		return float_t(10)*std::max(_ymax, std::numeric_limits<float_t>::min());
+	}
+
+	float_t maxsignal(const smt::darray<float_t, 1>& y) const {
 		float_t y_max = -std::numeric_limits<float_t>::infinity();
-		for(std::size_t ii = 0; ii < _y.size(); ++ii) {
-			y_max = std::max(y_max, _y(ii));
+		for(std::size_t ii = 0; ii < y.size(); ++ii) {
+			y_max = std::max(y_max, y(ii));
 		}
 
 		return y_max;
 	}
+
+	float_t sumsq(const smt::shells<float_t>& shells) const {
+		float_t sumsq = 0;
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			sumsq += shells.sumsq(ii);
+		}
+
+		return sumsq;
+	}
+};
+
+// Variable projection of the zero b-value signal, which enters the model
+// linearly and is eliminated by its weighted least-squares estimate for the
+// given intra-neurite volume fraction and diffusivity.
+
+template <typename float_t>
+class McMicro0ProjFunction {
+public:
+	McMicro0ProjFunction(const smt::darray<float_t, 1>& y,
+			const smt::diffenc<float_t>& dw,
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_shells(y, dw),
+				_intramax(1),
+				_diffmax(diffmax),
+				_approx(approx),
+				_sumsq(sumsq(_shells)),
+				_intrasignal(_shells.size()),
+				_extrasignal(_shells.size()) {
+	}
+
+	float_t operator()(const smt::sarray<float_t, 2>& x) const {
+		return value(trans(x));
+	}
+
+	// Cost function value in terms of the model parameters, which allows
+	// solvers with simple bounds, see lower() and upper().
+	float_t value(const smt::sarray<float_t, 2>& y) const {
+		const float_t intra = y(0);
+		const float_t diff = y(1);
+		signal(intra, diff, _intrasignal);
+		const float_t e0 = scale(_intrasignal);
+		float_t fval = _sumsq;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			fval += _shells.count(ii)*smt::pow2(_shells.mean(ii)-e0*_intrasignal(ii));
+		}
+
+		return fval;
+	}
+
+	std::size_t residuals() const {
+		return _shells.size();
+	}
+
+	void jacobian(const smt::sarray<float_t, 2>& x, smt::darray<float_t, 1>& r, smt::darray<smt::sarray<float_t, 2>, 1>& J) const {
+		const float_t intra = smt::expit(x(0), _intramax);
+		const float_t diff = smt::expit(x(1), _diffmax);
+		const float_t dintra = smt::dexpit(x(0), _intramax);
+		const float_t ddiff = smt::dexpit(x(1), _diffmax);
+		float_t num = 0;
+		float_t den = 0;
+		smt::sarray<float_t, 2> dnum = 0;
+		smt::sarray<float_t, 2> dden = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t bvalue = _shells.bvalue(ii);
+			const float_t n = _shells.count(ii);
+			const float_t s = signal(bvalue, intra, diff);
+			smt::sarray<float_t, 2> ds = dsignal(bvalue, intra, diff);
+			ds(0) *= dintra;
+			ds(1) *= ddiff;
+			_intrasignal(ii) = s;
+			J(ii) = ds;
+			num += n*_shells.mean(ii)*s;
+			den += n*s*s;
+			dnum += n*_shells.mean(ii)*ds;
+			dden += float_t(2)*n*s*ds;
+		}
+		den = std::max(den, std::numeric_limits<float_t>::min());
+		const float_t e0 = std::max(num, float_t(0))/den;
+		smt::sarray<float_t, 2> de0 = 0;
+		if(num > float_t(0)) {
+			de0 = (dnum-e0*dden)/den;
+		}
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t w = std::sqrt(float_t(_shells.count(ii)));
+			r(ii) = w*(_shells.mean(ii)-e0*_intrasignal(ii));
+			J(ii) = -w*(de0*_intrasignal(ii)+e0*J(ii));
+		}
+	}
+
+	smt::sarray<float_t, 2> init() const {
+		smt::sarray<float_t, 2> x0;
+		x0(0) = smt::logit(float_t(0.5)*_intramax, _intramax);
+		x0(1) = smt::logit(float_t(0.5)*_diffmax, _diffmax);
+
+		float_t s0 = 0;
+		float_t mean = 0;
+		float_t var = 0;
+		if(smt::cumulant(_shells, s0, mean, var)) {
+			const smt::sarray<float_t, 2> x = smt::mcmicromoments(mean, var, _diffmax);
+			const smt::sarray<float_t, 2> x1 = init(x);
+			if(operator()(x1) < operator()(x0)) {
+				return x1;
+			}
+		}
+
+		return x0;
+	}
+
+	smt::sarray<float_t, 2> init(const smt::sarray<float_t, 2>& x) const {
+		smt::sarray<float_t, 2> x0;
+		x0(0) = smt::logit(x(0), _intramax);
+		x0(1) = smt::logit(x(1), _diffmax);
+
+		return x0;
+	}
+
+	bool admissible(const smt::sarray<float_t, 2>& x) const {
+		return x(0) > float_t(0) && x(0) < _intramax &&
+				x(1) > float_t(0) && x(1) < _diffmax;
+	}
+
+	smt::sarray<float_t, 2> lower() const {
+		return smt::sarray<float_t, 2>{smt::logit_lower(_intramax), smt::logit_lower(_diffmax)};
+	}
+
+	smt::sarray<float_t, 2> upper() const {
+		return smt::sarray<float_t, 2>{smt::logit_upper(_intramax), smt::logit_upper(_diffmax)};
+	}
+
+	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
+		smt::sarray<float_t, 2> y;
+		y(0) = smt::expit(x(0), _intramax);
+		y(1) = smt::expit(x(1), _diffmax);
+
+		return y;
+	}
+
+	smt::sarray<float_t, 3> trans0(const smt::sarray<float_t, 2>& x) const {
+		smt::sarray<float_t, 3> y;
+		y(0) = smt::expit(x(0), _intramax);
+		y(1) = smt::expit(x(1), _diffmax);
+		signal(y(0), y(1), _intrasignal);
+		y(2) = scale(_intrasignal);
+
+		return y;
+	}
+
+	~McMicro0ProjFunction() {
+	}
+
+private:
+	const smt::shells<float_t> _shells;
+	const float_t _intramax;
+	const float_t _diffmax;
+	const bool _approx;
+	const float_t _sumsq;
+	mutable smt::darray<float_t, 1> _intrasignal;
+	mutable smt::darray<float_t, 1> _extrasignal;
+
+	float_t meansignal(const float_t& bvalue, const float_t& lambda1, const float_t& lambda2) const {
+		if(_approx) {
+			return smt::meansignal_approx(bvalue, lambda1, lambda2);
+		} else {
+			return smt::meansignal(bvalue, lambda1, lambda2);
+		}
+	}
+
+	void meansignal(const float_t& lambda1, const float_t& lambda2, smt::darray<float_t, 1>& s) const {
+		if(_approx) {
+			smt::meansignal_approx(_shells.bvalues(), lambda1, lambda2, s);
+		} else {
+			smt::meansignal(_shells.bvalues(), lambda1, lambda2, s);
+		}
+	}
+
+	float_t tortuosity(const float_t& intra) const {
+		return float_t(1)-smt::project(intra, float_t(0), _intramax);
+	}
+
+	float_t signal(const float_t& bvalue, const float_t& intra, const float_t& diff) const {
+		return intra*meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*meansignal(bvalue, diff, tortuosity(intra)*diff);
+	}
+
+	// Overwrites the extra-neurite signal buffer.
+	void signal(const float_t& intra, const float_t& diff, smt::darray<float_t, 1>& s) const {
+		meansignal(diff, float_t(0), s);
+		meansignal(diff, tortuosity(intra)*diff, _extrasignal);
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			s(ii) = intra*s(ii)+(float_t(1)-intra)*_extrasignal(ii);
+		}
+	}
+
+	smt::sarray<float_t, 2> dsignal(const float_t& bvalue, const float_t& intra, const float_t& diff) const {
+		const float_t tort = tortuosity(intra);
+		const smt::sarray<float_t, 2> ds_intra = smt::dmeansignal(bvalue, diff, float_t(0));
+		const smt::sarray<float_t, 2> ds_extra = smt::dmeansignal(bvalue, diff, tort*diff);
+		smt::sarray<float_t, 2> ds;
+		ds(0) = meansignal(bvalue, diff, float_t(0))-meansignal(bvalue, diff, tort*diff)-(float_t(1)-intra)*ds_extra(1)*diff;
+		ds(1) = intra*ds_intra(0)+(float_t(1)-intra)*(ds_extra(0)+ds_extra(1)*tort);
+
+		return ds;
+	}
+
+	float_t scale(const smt::darray<float_t, 1>& s) const {
+		float_t num = 0;
+		float_t den = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			num += _shells.count(ii)*_shells.mean(ii)*s(ii);
+			den += _shells.count(ii)*s(ii)*s(ii);
+		}
+
+		return std::max(num, float_t(0))/std::max(den, std::numeric_limits<float_t>::min());
+	}
+
+	float_t sumsq(const smt::shells<float_t>& shells) const {
+		float_t sumsq = 0;
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			sumsq += shells.sumsq(ii);
+		}
+
+		return sumsq;
+	}
 };
 
+// Cost function of McMicroFunction for K voxels with common diffusion encoding
+// in lockstep, see MicroDTLockstepFunction.
+
+template <typename float_t, std::size_t K>
+class McMicroLockstepFunction {
+public:
+	McMicroLockstepFunction(const smt::diffenc<float_t>& dw,
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_intramax(1),
+				_diffmax(diffmax),
+				_approx(approx),
+				_intra(K),
+				_diff(K),
+				_zero(K),
+				_extradiff(K),
+				_intrasignal(K),
+				_extrasignal(K) {
+		smt::darray<float_t, 1> y(dw.mapping.size());
+		std::fill(y.begin(), y.end(), float_t(0));
+		const smt::shells<float_t> shells(y, dw);
+		_bvalues.resize(shells.size());
+		_counts.resize(shells.size());
+		_means.resize(shells.size(), K);
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			_bvalues(ii) = shells.bvalue(ii);
+			_counts(ii) = shells.count(ii);
+		}
+		std::fill(_means.begin(), _means.end(), float_t(0));
+		for(std::size_t ll = 0; ll < K; ++ll) {
+			_y0(ll) = 0;
+			_sumsq(ll) = 0;
+			_zero(ll) = 0;
+		}
+	}
+
+	// Assigns the voxel of the given cost function to a lane.
+	void assign(const std::size_t& ll, const McMicroFunction<float_t>& f) {
+		const smt::shells<float_t>& shells = f.shells();
+		smt::assert(shells.size() == _bvalues.size());
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			_means(ii, ll) = shells.mean(ii);
+		}
+		_y0(ll) = f.y0();
+		_sumsq(ll) = f.sumsq();
+	}
+
+	void operator()(const smt::sarray<smt::sarray<float_t, 2>, K>& x, smt::sarray<float_t, K>& fval) const {
+		float_t* intra = _intra.begin();
+		float_t* diff = _diff.begin();
+		float_t* extradiff = _extradiff.begin();
+		for(std::size_t ll = 0; ll < K; ++ll) {
+			intra[ll] = smt::expit(x(ll)(0), _intramax);
+			diff[ll] = smt::expit(x(ll)(1), _diffmax);
+			extradiff[ll] = (float_t(1)-smt::project(intra[ll], float_t(0), _intramax))*diff[ll];
+			fval(ll) = _sumsq(ll);
+		}
+		const float_t* s1 = _intrasignal.begin();
+		const float_t* s2 = _extrasignal.begin();
+		for(std::size_t ii = 0; ii < _bvalues.size(); ++ii) {
+			if(_bvalues(ii) > float_t(0)) {
+				if(_approx) {
+					smt::meansignal_approx(_bvalues(ii), _diff, _zero, _intrasignal);
+					smt::meansignal_approx(_bvalues(ii), _diff, _extradiff, _extrasignal);
+				} else {
+					smt::meansignal(_bvalues(ii), _diff, _zero, _intrasignal);
+					smt::meansignal(_bvalues(ii), _diff, _extradiff, _extrasignal);
+				}
+				const float_t* mean = _means.begin()+ii*K;
+				for(std::size_t ll = 0; ll < K; ++ll) {
+					fval(ll) += _counts(ii)*smt::pow2(mean[ll]-_y0(ll)*(intra[ll]*s1[ll]+(float_t(1)-intra[ll])*s2[ll]));
+				}
+			}
+		}
+	}
+
+	~McMicroLockstepFunction() {
+	}
+
+private:
+	const float_t _intramax;
+	const float_t _diffmax;
+	const bool _approx;
+	smt::darray<float_t, 1> _bvalues;
+	smt::darray<std::size_t, 1> _counts;
+	smt::darray<float_t, 2> _means;
+	smt::sarray<float_t, K> _y0;
+	smt::sarray<float_t, K> _sumsq;
+	mutable smt::darray<float_t, 1> _intra;
+	mutable smt::darray<float_t, 1> _diff;
+	smt::darray<float_t, 1> _zero;
+	mutable smt::darray<float_t, 1> _extradiff;
+	mutable smt::darray<float_t, 1> _intrasignal;
+	mutable smt::darray<float_t, 1> _extrasignal;
+};
+
+// Estimation starting from the given parameters, e.g. those of a neighbouring
+// voxel, where the default starting point is used instead if the parameters
+// are not admissible or fit the data worse, see smt::start.
+
 template <typename float_t>
 smt::sarray<float_t, 3> fitmcmicro(const smt::darray<float_t, 1>& y,
 		const smt::diffenc<float_t>& dw,
+		const smt::sarray<float_t, 3>& x0,
+		smt::optinfo<float_t>& info,
 		const float_t& diffmax = 3.05e-3,
 		const bool& b0 = false,
+		const bool& varpro = false,
+		const smt::solver& method = smt::solver::neldermead,
+		const bool& approx = false,
 		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
-		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
-
-	// TODO: Random initialisation?
-
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
 	if(! b0 && dw.any_zero_bvalue()) {
-		McMicroFunction<float_t> f(y, dw, diffmax);
-		smt::sNelderMead<float_t, 2, McMicroFunction<float_t>> ssolver(f);
-		ssolver.init(f.init());
-		ssolver.solve(opt_rel, opt_abs);
-		const smt::sarray<float_t, 3> x = f.trans0(ssolver());
+		McMicroFunction<float_t> f(y, dw, diffmax, approx);
+		const smt::sarray<float_t, 3> x = f.trans0(smt::minimise(f, smt::start(f, smt::sarray<float_t, 2>{x0(0), x0(1)}), info, method, opt_rel, opt_abs, max_iter));
+
+		return x;
+	} else if(varpro) {
+		McMicro0ProjFunction<float_t> f(y, dw, diffmax, approx);
+		const smt::sarray<float_t, 3> x = f.trans0(smt::minimise(f, smt::start(f, smt::sarray<float_t, 2>{x0(0), x0(1)}), info, method, opt_rel, opt_abs, max_iter));
 
 		return x;
 	} else {
-		McMicro0Function<float_t> f(y, dw, diffmax);
-		smt::sNelderMead<float_t, 3, McMicro0Function<float_t>> ssolver(f);
-		ssolver.init(f.init());
-		ssolver.solve(opt_rel, opt_abs);
-		const smt::sarray<float_t, 3> x = f.trans(ssolver());
+		McMicro0Function<float_t> f(y, dw, diffmax, approx);
+		const smt::sarray<float_t, 3> x = f.trans(smt::minimise(f, smt::start(f, x0), info, method, opt_rel, opt_abs, max_iter));
 
 		return x;
 	}
 }
 
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicro(const smt::darray<float_t, 1>& y,
+		const smt::diffenc<float_t>& dw,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const bool& varpro = false,
+		const smt::solver& method = smt::solver::neldermead,
+		const bool& approx = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::optinfo<float_t> info;
+
+	return fitmcmicro(y, dw, smt::sarray<float_t, 3>{0, 0, 0}, info, diffmax, b0, varpro, method, approx, opt_rel, opt_abs, max_iter);
+}
+
+// Mixed-precision estimation, where the given method iterates on the
+// single-precision cost function up to the resolution of single precision, and
+// the Levenberg-Marquardt method refines the estimates in the precision of
+// float_t to the given tolerance. The single-precision copy dw_single of the
+// diffusion encoding is provided by the caller, such that it is converted once
+// rather than per voxel. The iteration counts are summed over both stages.
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmcmicromixed(const smt::darray<float_t, 1>& y,
+		const smt::diffenc<float_t>& dw,
+		const smt::diffenc<float>& dw_single,
+		const smt::sarray<float_t, 3>& x0,
+		smt::optinfo<float_t>& info,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const bool& varpro = false,
+		const smt::solver& method = smt::solver::neldermead,
+		const bool& approx = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::darray<float, 1> y_single(y.size(0));
+	for(std::size_t ii = 0; ii < y.size(0); ++ii) {
+		y_single(ii) = y(ii);
+	}
+	smt::optinfo<float> info_single;
+	const smt::sarray<float, 3> x_single = fitmcmicro(y_single, dw_single,
+			smt::sarray<float, 3>{float(x0(0)), float(x0(1)), float(x0(2))}, info_single,
+			float(diffmax), b0, varpro, method, approx,
+			100*std::numeric_limits<float>::epsilon(), std::numeric_limits<float>::epsilon(), max_iter);
+
+	const smt::sarray<float_t, 3> x = fitmcmicro(y, dw,
+			smt::sarray<float_t, 3>{x_single(0), x_single(1), x_single(2)}, info,
+			diffmax, b0, varpro, smt::solver::levmar, approx, opt_rel, opt_abs, max_iter);
+	info.iter += info_single.iter;
+	info.f_calls += info_single.f_calls;
+
+	return x;
+}
+
+// Lockstep estimation of a sequence of voxels with common diffusion encoding,
+// which are distributed over K lanes, where the zero b-value signal is given by
+// the mean over the measurements with zero b-value. The starting points are
+// chosen as in the voxelwise estimation, and each voxel follows the same
+// sequence of Nelder-Mead steps, see smt::sNelderMeadLockstep.
+
+template <typename float_t, std::size_t K>
+void fitmcmicrolockstep(const std::vector<smt::darray<float_t, 1>>& y,
+		const smt::diffenc<float_t>& dw,
+		const std::vector<smt::sarray<float_t, 3>>& x0,
+		std::vector<smt::sarray<float_t, 3>>& x,
+		std::vector<smt::optinfo<float_t>>& info,
+		const float_t& diffmax = 3.05e-3,
+		const bool& approx = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::assert(x0.size() == y.size());
+
+	const std::size_t n = y.size();
+	std::vector<McMicroFunction<float_t>> f;
+	f.reserve(n);
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		f.emplace_back(y[ii], dw, diffmax, approx);
+	}
+	x.resize(n);
+	info.resize(n);
+
+	McMicroLockstepFunction<float_t, K> g(dw, diffmax, approx);
+	smt::sNelderMeadLockstep<float_t, 2, K, McMicroLockstepFunction<float_t, K>> solver(g);
+	smt::sarray<std::size_t, K> voxel;
+	for(std::size_t ll = 0; ll < K; ++ll) {
+		voxel(ll) = n;
+	}
+	std::size_t next = 0;
+	solver.solve([&](const std::size_t& ll) {
+		if(voxel(ll) < n) {
+			const std::size_t ii = voxel(ll);
+			x[ii] = f[ii].trans0(solver(ll));
+			info[ii].iter = solver.iter(ll);
+			info[ii].f_calls = solver.f_calls(ll);
+			info[ii].converged = solver.converged(ll);
+			info[ii].fval = solver.fval(ll);
+		}
+		voxel(ll) = n;
+		if(next < n) {
+			voxel(ll) = next;
+			g.assign(ll, f[next]);
+			solver.init(ll, smt::start(f[next], smt::sarray<float_t, 2>{x0[next](0), x0[next](1)}));
+			++next;
+		}
+	}, opt_rel, opt_abs, max_iter);
+}
+
+// Dictionary of the multi-compartment microscopic diffusion model, see
+// dictionary.h. The estimates comprise the intra-neurite volume fraction, the
+// intrinsic diffusivity and the zero b-value signal.
+
+template <typename float_t>
+smt::dictionary<float_t> mcmicrodictionary(const smt::diffenc<float_t>& dw,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const std::size_t& n = 100) {
+	return smt::dictionary<float_t>(dw, ! b0 && dw.any_zero_bvalue(),
+			[](const float_t& bvalue, const float_t& intra, const float_t& diff) {
+				return intra*smt::meansignal(bvalue, diff, float_t(0))+(float_t(1)-intra)*smt::meansignal(bvalue, diff, (float_t(1)-intra)*diff);
+			},
+			{float_t(0), float_t(0)}, {float_t(1), diffmax}, n);
+}
+
 } // smt
 
 #endif // _FITMCMICRO_H
@@ -27,17 +27,25 @@
 #ifndef _FITMICRODT_H
 #define _FITMICRODT_H
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
+#include <vector>
 
+#include "brent.h"
+#include "cumulant.h"
 #include "darray.h"
 #include "debug.h"
+#include "dictionary.h"
 #include "diffenc.h"
 #include "logit.h"
 #include "meansignal.h"
-#include "neldermead.h"
+#include "neldermeadlockstep.h"
 #include "pow.h"
+#include "project.h"
 #include "sarray.h"
+#include "shells.h"
+#include "solver.h"
 
 namespace smt {
 
@@ -48,73 +56,224 @@ namespace smt {
 //   Medicine, 75:1752–1763, 2016.  http://dx.doi.org/10.1002/mrm.25734
 //
 
+// Microscopic diffusivities matching the mean and variance of the apparent
+// diffusion coefficient, see cumulant.h. For an axially symmetric tensor, the
+// apparent diffusion coefficient lambda2+(lambda1-lambda2)cos^2(theta) has the
+// variance 4/45 (lambda1-lambda2)^2 over the sphere. The diffusivities are
+// projected into the interior of the admissible range, and false is returned
+// if either of them is outside. A projected lambda1 close to diffmax is a poor
+// starting point, as the ordered parametrisation below is nearly flat there.
+
+template <typename float_t>
+bool microdtmoments(const float_t& mean, const float_t& var, const float_t& diffmax, smt::sarray<float_t, 2>& x) {
+	const float_t delta = std::sqrt(float_t(45)/float_t(4)*var);
+	const float_t lambda1 = mean+float_t(2)/float_t(3)*delta;
+	const float_t lambda2 = mean-float_t(1)/float_t(3)*delta;
+	const float_t lo = float_t(0.01)*diffmax;
+	const float_t hi = float_t(0.99)*diffmax;
+	x(0) = smt::project(lambda1, lo, hi);
+	x(1) = smt::project(lambda2, lo, hi);
+
+	return x(0) == lambda1 && x(1) == lambda2;
+}
+
+// Ordered parametrisation of the microscopic diffusivities, where lambda2 is
+// the logistic function of x(1) in the range (0, diffmax) and the non-negative
+// increment lambda1-lambda2 equals the fraction 1-exp(-x(0)^2) of the range
+// (0, diffmax-lambda2). This removes the exchange symmetry of lambda1 and
+// lambda2. The remaining symmetry in x(0) is harmless, as the cost function is
+// smooth in x(0) across the ridge lambda1 == lambda2, where the derivatives of
+// the spherical mean signal in lambda1 and lambda2 are discontinuous. On the
+// ridge, however, the derivative in x(0) vanishes, hence microdtlogit keeps the
+// increment at least sqrt(epsilon) of the range, such that gradient-based
+// solvers started there can leave the ridge.
+
+template <typename float_t>
+smt::sarray<float_t, 2> microdtexpit(const smt::sarray<float_t, 2>& x, const float_t& diffmax) {
+	const float_t z = -std::expm1(-smt::pow2(x(0)));
+	smt::sarray<float_t, 2> y;
+	y(1) = smt::expit(x(1), diffmax);
+	y(0) = y(1)+z*(diffmax-y(1));
+
+	return y;
+}
+
+template <typename float_t>
+smt::sarray<float_t, 2> microdtlogit(const smt::sarray<float_t, 2>& y, const float_t& diffmax) {
+	const float_t lambda1 = std::max(y(0), y(1));
+	const float_t lambda2 = std::min(y(0), y(1));
+	const float_t z = smt::project((lambda1-lambda2)/(diffmax-lambda2), std::sqrt(std::numeric_limits<float_t>::epsilon()), smt::logit_upper(float_t(1)));
+	smt::sarray<float_t, 2> x;
+	x(0) = std::sqrt(-std::log1p(-z));
+	x(1) = smt::logit(lambda2, diffmax);
+
+	return x;
+}
+
+// Jacobian of microdtexpit, i.e. dlambda1/dx(0), dlambda1/dx(1) and
+// dlambda2/dx(1), noting that dlambda2/dx(0) vanishes.
+
+template <typename float_t>
+smt::sarray<float_t, 3> microdtdexpit(const smt::sarray<float_t, 2>& x, const float_t& diffmax) {
+	const float_t z = -std::expm1(-smt::pow2(x(0)));
+	const float_t dz = float_t(2)*x(0)*std::exp(-smt::pow2(x(0)));
+	const float_t lambda2 = smt::expit(x(1), diffmax);
+	const float_t dlambda2 = smt::dexpit(x(1), diffmax);
+
+	return smt::sarray<float_t, 3>{dz*(diffmax-lambda2), (float_t(1)-z)*dlambda2, dlambda2};
+}
+
 template <typename float_t>
 class MicroDTFunction {
 public:
 	MicroDTFunction(const smt::darray<float_t, 1>& y,
 			const smt::diffenc<float_t>& dw,
-			const float_t& diffmax = 3.05e-3):
-				_y(y),
-				_dw(dw),
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_shells(y, dw),
 				_diffmax(diffmax),
-				_y0(mean(y, dw)) {
+				_approx(approx),
+				_y0(mean(y, dw)),
+				_sumsq(sumsq(_shells)),
+				_signal(_shells.size()) {
 	}
 
 	float_t operator()(const smt::sarray<float_t, 2>& x) const {
-		const float_t diff1 = smt::expit(x(0), _diffmax);
-		const float_t diff2 = smt::expit(x(1), _diffmax);
-		float_t fval = 0;
-		for(std::size_t ii = 0; ii < _dw.mapping.size(); ++ii) {
-			const float_t bvalue = _dw.bvalues(_dw.mapping(ii));
-			if(bvalue > float_t(0)) {
-				fval += smt::pow2(_y(ii)-_y0*smt::meansignal(bvalue, diff1, diff2));
+		return value(trans(x));
+	}
+
+	// Cost function value in terms of the model parameters, which allows
+	// solvers with simple bounds, see lower() and upper().
+	float_t value(const smt::sarray<float_t, 2>& y) const {
+		const float_t diff1 = y(0);
+		const float_t diff2 = y(1);
+		meansignal(diff1, diff2, _signal);
+		float_t fval = _sumsq;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			if(_shells.bvalue(ii) > float_t(0)) {
+				fval += _shells.count(ii)*smt::pow2(_shells.mean(ii)-_y0*_signal(ii));
 			}
 		}
 
 		return fval;
 	}
 
+	std::size_t residuals() const {
+		std::size_t n = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			if(_shells.bvalue(ii) > float_t(0)) {
+				++n;
+			}
+		}
+
+		return n;
+	}
+
+	void jacobian(const smt::sarray<float_t, 2>& x, smt::darray<float_t, 1>& r, smt::darray<smt::sarray<float_t, 2>, 1>& J) const {
+		const smt::sarray<float_t, 2> y = microdtexpit(x, _diffmax);
+		const float_t diff1 = y(0);
+		const float_t diff2 = y(1);
+		const smt::sarray<float_t, 3> dy = microdtdexpit(x, _diffmax);
+		std::size_t kk = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t bvalue = _shells.bvalue(ii);
+			if(bvalue > float_t(0)) {
+				const float_t w = std::sqrt(float_t(_shells.count(ii)));
+				const smt::sarray<float_t, 2> ds = smt::dmeansignal(bvalue, diff1, diff2);
+				r(kk) = w*(_shells.mean(ii)-_y0*meansignal(bvalue, diff1, diff2));
+				J(kk)(0) = -w*_y0*ds(0)*dy(0);
+				J(kk)(1) = -w*_y0*(ds(0)*dy(1)+ds(1)*dy(2));
+				++kk;
+			}
+		}
+	}
+
 	smt::sarray<float_t, 2> init() const {
-		smt::sarray<float_t, 2> x0;
-		x0(0) = smt::logit(2/float_t(3)*_diffmax, _diffmax);
-		x0(1) = smt::logit(1/float_t(3)*_diffmax, _diffmax);
+		const smt::sarray<float_t, 2> x0 = init(smt::sarray<float_t, 2>{2/float_t(3)*_diffmax, 1/float_t(3)*_diffmax});
+
+		float_t s0 = 0;
+		float_t mean = 0;
+		float_t var = 0;
+		smt::sarray<float_t, 2> x;
+		if(smt::cumulant(_shells, s0, mean, var) && smt::microdtmoments(mean, var, _diffmax, x)) {
+			const smt::sarray<float_t, 2> x1 = init(x);
+			if(operator()(x1) < operator()(x0)) {
+				return x1;
+			}
+		}
 
 		return x0;
 	}
 
 	smt::sarray<float_t, 2> init(const smt::sarray<float_t, 2>& x) const {
-		smt::sarray<float_t, 2> x0;
-		x0(0) = smt::logit(x(0), _diffmax);
-		x0(1) = smt::logit(x(1), _diffmax);
+		return microdtlogit(x, _diffmax);
+	}
 
-		return x0;
+	bool admissible(const smt::sarray<float_t, 2>& x) const {
+		return x(0) > float_t(0) && x(0) < _diffmax &&
+				x(1) > float_t(0) && x(1) < _diffmax;
 	}
 
-	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
-		smt::sarray<float_t, 2> y;
-		y(0) = smt::expit(x(0), _diffmax);
-		y(1) = smt::expit(x(1), _diffmax);
+	smt::sarray<float_t, 2> lower() const {
+		return smt::sarray<float_t, 2>{smt::logit_lower(_diffmax), smt::logit_lower(_diffmax)};
+	}
 
-		return y;
+	smt::sarray<float_t, 2> upper() const {
+		return smt::sarray<float_t, 2>{smt::logit_upper(_diffmax), smt::logit_upper(_diffmax)};
+	}
+
+	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
+		return microdtexpit(x, _diffmax);
 	}
 
 	smt::sarray<float_t, 3> trans0(const smt::sarray<float_t, 2>& x) const {
+		const smt::sarray<float_t, 2> diff = microdtexpit(x, _diffmax);
 		smt::sarray<float_t, 3> y;
-		y(0) = smt::expit(x(0), _diffmax);
-		y(1) = smt::expit(x(1), _diffmax);
+		y(0) = diff(0);
+		y(1) = diff(1);
 		y(2) = _y0;
 
 		return y;
 	}
 
+	const smt::shells<float_t>& shells() const {
+		return _shells;
+	}
+
+	float_t y0() const {
+		return _y0;
+	}
+
+	float_t sumsq() const {
+		return _sumsq;
+	}
+
 	~MicroDTFunction() {
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
-	const smt::diffenc<float_t> _dw;
+	const smt::shells<float_t> _shells;
 	const float_t _diffmax;
+	const bool _approx;
 	const float_t _y0;
+	const float_t _sumsq;
+	mutable smt::darray<float_t, 1> _signal;
+
+	float_t meansignal(const float_t& bvalue, const float_t& lambda1, const float_t& lambda2) const {
+		if(_approx) {
+			return smt::meansignal_approx(bvalue, lambda1, lambda2);
+		} else {
+			return smt::meansignal(bvalue, lambda1, lambda2);
+		}
+	}
+
+	void meansignal(const float_t& lambda1, const float_t& lambda2, smt::darray<float_t, 1>& s) const {
+		if(_approx) {
+			smt::meansignal_approx(_shells.bvalues(), lambda1, lambda2, s);
+		} else {
+			smt::meansignal(_shells.bvalues(), lambda1, lambda2, s);
+		}
+	}
 
 	float_t mean(const smt::darray<float_t, 1>& y, const smt::diffenc<float_t>& dw) const {
 		float_t y0 = 0;
@@ -130,6 +289,17 @@ private:
 
 		return y0;
 	}
+
+	float_t sumsq(const smt::shells<float_t>& shells) const {
+		float_t sumsq = 0;
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			if(shells.bvalue(ii) > float_t(0)) {
+				sumsq += shells.sumsq(ii);
+			}
+		}
+
+		return sumsq;
+	}
 };
 
 template <typename float_t>
@@ -137,47 +307,103 @@ class MicroDT0Function {
 public:
 	MicroDT0Function(const smt::darray<float_t, 1>& y,
 			const smt::diffenc<float_t>& dw,
-			const float_t& diffmax = 3.05e-3):
-				_y(y),
-				_dw(dw),
-				_diffmax(diffmax) {
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_shells(y, dw),
+				_diffmax(diffmax),
+				_approx(approx),
+				_ymax(maxsignal(y)),
+				_sumsq(sumsq(_shells)),
+				_signal(_shells.size()) {
 	}
 
 	float_t operator()(const smt::sarray<float_t, 3>& x) const {
-		const float_t diff1 = smt::expit(x(0), _diffmax);
-		const float_t diff2 = smt::expit(x(1), _diffmax);
-		const float_t e0 = std::exp(x(2));
-		float_t fval = 0;
-		for(std::size_t ii = 0; ii < _dw.mapping.size(); ++ii) {
-			const float_t bvalue = _dw.bvalues(_dw.mapping(ii));
-			fval += smt::pow2(_y(ii)-e0*smt::meansignal(bvalue, diff1, diff2));
+		return value(trans(x));
+	}
+
+	// Cost function value in terms of the model parameters, which allows
+	// solvers with simple bounds, see lower() and upper().
+	float_t value(const smt::sarray<float_t, 3>& y) const {
+		const float_t diff1 = y(0);
+		const float_t diff2 = y(1);
+		const float_t e0 = y(2);
+		meansignal(diff1, diff2, _signal);
+		float_t fval = _sumsq;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			fval += _shells.count(ii)*smt::pow2(_shells.mean(ii)-e0*_signal(ii));
 		}
 
 		return fval;
 	}
 
+	std::size_t residuals() const {
+		return _shells.size();
+	}
+
+	void jacobian(const smt::sarray<float_t, 3>& x, smt::darray<float_t, 1>& r, smt::darray<smt::sarray<float_t, 3>, 1>& J) const {
+		const smt::sarray<float_t, 2> diff = microdtexpit(smt::sarray<float_t, 2>{x(0), x(1)}, _diffmax);
+		const float_t diff1 = diff(0);
+		const float_t diff2 = diff(1);
+		const smt::sarray<float_t, 3> ddiff = microdtdexpit(smt::sarray<float_t, 2>{x(0), x(1)}, _diffmax);
+		const float_t e0 = std::exp(x(2));
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t bvalue = _shells.bvalue(ii);
+			const float_t w = std::sqrt(float_t(_shells.count(ii)));
+			const float_t s = meansignal(bvalue, diff1, diff2);
+			const smt::sarray<float_t, 2> ds = smt::dmeansignal(bvalue, diff1, diff2);
+			r(ii) = w*(_shells.mean(ii)-e0*s);
+			J(ii)(0) = -w*e0*ds(0)*ddiff(0);
+			J(ii)(1) = -w*e0*(ds(0)*ddiff(1)+ds(1)*ddiff(2));
+			J(ii)(2) = -w*e0*s;
+		}
+	}
+
 	smt::sarray<float_t, 3> init() const {
-		smt::sarray<float_t, 3> x0;
-		x0(0) = smt::logit(2/float_t(3)*_diffmax, _diffmax);
-		x0(1) = smt::logit(1/float_t(3)*_diffmax, _diffmax);
-		x0(2) = std::log(maxsignal());
+		const smt::sarray<float_t, 3> x0 = init(smt::sarray<float_t, 3>{2/float_t(3)*_diffmax, 1/float_t(3)*_diffmax, _ymax});
+
+		float_t s0 = 0;
+		float_t mean = 0;
+		float_t var = 0;
+		smt::sarray<float_t, 2> x;
+		if(smt::cumulant(_shells, s0, mean, var) && smt::microdtmoments(mean, var, _diffmax, x)) {
+			const smt::sarray<float_t, 3> x1 = init(smt::sarray<float_t, 3>{x(0), x(1), s0});
+			if(operator()(x1) < operator()(x0)) {
+				return x1;
+			}
+		}
 
 		return x0;
 	}
 
 	smt::sarray<float_t, 3> init(const smt::sarray<float_t, 3>& x) const {
+		const smt::sarray<float_t, 2> diff = microdtlogit(smt::sarray<float_t, 2>{x(0), x(1)}, _diffmax);
 		smt::sarray<float_t, 3> x0;
-		x0(0) = smt::logit(x(0), _diffmax);
-		x0(1) = smt::logit(x(1), _diffmax);
+		x0(0) = diff(0);
+		x0(1) = diff(1);
 		x0(2) = std::log(x(2));
 
 		return x0;
 	}
 
+	bool admissible(const smt::sarray<float_t, 3>& x) const {
+		return x(0) > float_t(0) && x(0) < _diffmax &&
+				x(1) > float_t(0) && x(1) < _diffmax &&
+				x(2) > float_t(0);
+	}
+
+	smt::sarray<float_t, 3> lower() const {
+		return smt::sarray<float_t, 3>{smt::logit_lower(_diffmax), smt::logit_lower(_diffmax), smt::logit_lower(smax())};
+	}
+
+	smt::sarray<float_t, 3> upper() const {
+		return smt::sarray<float_t, 3>{smt::logit_upper(_diffmax), smt::logit_upper(_diffmax), smax()};
+	}
+
 	smt::sarray<float_t, 3> trans(const smt::sarray<float_t, 3>& x) const {
+		const smt::sarray<float_t, 2> diff = microdtexpit(smt::sarray<float_t, 2>{x(0), x(1)}, _diffmax);
 		smt::sarray<float_t, 3> y;
-		y(0) = smt::expit(x(0), _diffmax);
-		y(1) = smt::expit(x(1), _diffmax);
+		y(0) = diff(0);
+		y(1) = diff(1);
 		y(2) = std::exp(x(2));
 
 		return y;
@@ -187,18 +413,223 @@ public:
 	}
 
 private:
-	const smt::darray<float_t, 1> _y;
-	const smt::diffenc<float_t> _dw;
+	const smt::shells<float_t> _shells;
 	const float_t _diffmax;
+	const bool _approx;
+	const float_t _ymax;
+	const float_t _sumsq;
+	mutable smt::darray<float_t, 1> _signal;
+
+	float_t meansignal(const float_t& bvalue, const float_t& lambda1, const float_t& lambda2) const {
+		if(_approx) {
+			return smt::meansignal_approx(bvalue, lambda1, lambda2);
+		} else {
+			return smt::meansignal(bvalue, lambda1, lambda2);
+		}
+	}
+
+	void meansignal(const float_t& lambda1, const float_t& lambda2, smt::darray<float_t, 1>& s) const {
+		if(_approx) {
+			smt::meansignal_approx(_shells.bvalues(), lambda1, lambda2, s);
+		} else {
+			smt::meansignal(_shells.bvalues(), lambda1, lambda2, s);
+		}
+	}
 
-	float_t maxsignal() const {
+	float_t smax() const {
+		return float_t(10)*std::max(_ymax, std::numeric_limits<float_t>::min());
+	}
+
+	float_t maxsignal(const smt::darray<float_t, 1>& y) const {
 		float_t y_max = -std::numeric_limits<float_t>::infinity();
-		for(std::size_t ii = 0; ii < _y.size(); ++ii) {
-			y_max = std::max(y_max, _y(ii));
+		for(std::size_t ii = 0; ii < y.size(); ++ii) {
+			y_max = std::max(y_max, y(ii));
 		}
 
 		return y_max;
 	}
+
+	float_t sumsq(const smt::shells<float_t>& shells) const {
+		float_t sumsq = 0;
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			sumsq += shells.sumsq(ii);
+		}
+
+		return sumsq;
+	}
+};
+
+// Variable projection of the zero b-value signal, which enters the model
+// linearly and is eliminated by its weighted least-squares estimate for the
+// given microscopic diffusivities. Only the two diffusivities are subject to
+// numerical optimisation.
+
+template <typename float_t>
+class MicroDT0ProjFunction {
+public:
+	MicroDT0ProjFunction(const smt::darray<float_t, 1>& y,
+			const smt::diffenc<float_t>& dw,
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_shells(y, dw),
+				_diffmax(diffmax),
+				_approx(approx),
+				_sumsq(sumsq(_shells)),
+				_signal(_shells.size()) {
+	}
+
+	float_t operator()(const smt::sarray<float_t, 2>& x) const {
+		return value(trans(x));
+	}
+
+	// Cost function value in terms of the model parameters, which allows
+	// solvers with simple bounds, see lower() and upper().
+	float_t value(const smt::sarray<float_t, 2>& y) const {
+		const float_t diff1 = y(0);
+		const float_t diff2 = y(1);
+		meansignal(diff1, diff2, _signal);
+		const float_t e0 = scale(_signal);
+		float_t fval = _sumsq;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			fval += _shells.count(ii)*smt::pow2(_shells.mean(ii)-e0*_signal(ii));
+		}
+
+		return fval;
+	}
+
+	std::size_t residuals() const {
+		return _shells.size();
+	}
+
+	void jacobian(const smt::sarray<float_t, 2>& x, smt::darray<float_t, 1>& r, smt::darray<smt::sarray<float_t, 2>, 1>& J) const {
+		const smt::sarray<float_t, 2> y = microdtexpit(x, _diffmax);
+		const float_t diff1 = y(0);
+		const float_t diff2 = y(1);
+		const smt::sarray<float_t, 3> dy = microdtdexpit(x, _diffmax);
+		float_t num = 0;
+		float_t den = 0;
+		smt::sarray<float_t, 2> dnum = 0;
+		smt::sarray<float_t, 2> dden = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t bvalue = _shells.bvalue(ii);
+			const float_t n = _shells.count(ii);
+			const float_t s = meansignal(bvalue, diff1, diff2);
+			const smt::sarray<float_t, 2> dsdiff = smt::dmeansignal(bvalue, diff1, diff2);
+			const smt::sarray<float_t, 2> ds{dsdiff(0)*dy(0), dsdiff(0)*dy(1)+dsdiff(1)*dy(2)};
+			_signal(ii) = s;
+			J(ii) = ds;
+			num += n*_shells.mean(ii)*s;
+			den += n*s*s;
+			dnum += n*_shells.mean(ii)*ds;
+			dden += float_t(2)*n*s*ds;
+		}
+		den = std::max(den, std::numeric_limits<float_t>::min());
+		const float_t e0 = std::max(num, float_t(0))/den;
+		smt::sarray<float_t, 2> de0 = 0;
+		if(num > float_t(0)) {
+			de0 = (dnum-e0*dden)/den;
+		}
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			const float_t w = std::sqrt(float_t(_shells.count(ii)));
+			r(ii) = w*(_shells.mean(ii)-e0*_signal(ii));
+			J(ii) = -w*(de0*_signal(ii)+e0*J(ii));
+		}
+	}
+
+	smt::sarray<float_t, 2> init() const {
+		const smt::sarray<float_t, 2> x0 = init(smt::sarray<float_t, 2>{2/float_t(3)*_diffmax, 1/float_t(3)*_diffmax});
+
+		float_t s0 = 0;
+		float_t mean = 0;
+		float_t var = 0;
+		smt::sarray<float_t, 2> x;
+		if(smt::cumulant(_shells, s0, mean, var) && smt::microdtmoments(mean, var, _diffmax, x)) {
+			const smt::sarray<float_t, 2> x1 = init(x);
+			if(operator()(x1) < operator()(x0)) {
+				return x1;
+			}
+		}
+
+		return x0;
+	}
+
+	smt::sarray<float_t, 2> init(const smt::sarray<float_t, 2>& x) const {
+		return microdtlogit(x, _diffmax);
+	}
+
+	bool admissible(const smt::sarray<float_t, 2>& x) const {
+		return x(0) > float_t(0) && x(0) < _diffmax &&
+				x(1) > float_t(0) && x(1) < _diffmax;
+	}
+
+	smt::sarray<float_t, 2> lower() const {
+		return smt::sarray<float_t, 2>{smt::logit_lower(_diffmax), smt::logit_lower(_diffmax)};
+	}
+
+	smt::sarray<float_t, 2> upper() const {
+		return smt::sarray<float_t, 2>{smt::logit_upper(_diffmax), smt::logit_upper(_diffmax)};
+	}
+
+	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
+		return microdtexpit(x, _diffmax);
+	}
+
+	smt::sarray<float_t, 3> trans0(const smt::sarray<float_t, 2>& x) const {
+		const smt::sarray<float_t, 2> diff = microdtexpit(x, _diffmax);
+		smt::sarray<float_t, 3> y;
+		y(0) = diff(0);
+		y(1) = diff(1);
+		meansignal(y(0), y(1), _signal);
+		y(2) = scale(_signal);
+
+		return y;
+	}
+
+	~MicroDT0ProjFunction() {
+	}
+
+private:
+	const smt::shells<float_t> _shells;
+	const float_t _diffmax;
+	const bool _approx;
+	const float_t _sumsq;
+	mutable smt::darray<float_t, 1> _signal;
+
+	float_t meansignal(const float_t& bvalue, const float_t& lambda1, const float_t& lambda2) const {
+		if(_approx) {
+			return smt::meansignal_approx(bvalue, lambda1, lambda2);
+		} else {
+			return smt::meansignal(bvalue, lambda1, lambda2);
+		}
+	}
+
+	void meansignal(const float_t& lambda1, const float_t& lambda2, smt::darray<float_t, 1>& s) const {
+		if(_approx) {
+			smt::meansignal_approx(_shells.bvalues(), lambda1, lambda2, s);
+		} else {
+			smt::meansignal(_shells.bvalues(), lambda1, lambda2, s);
+		}
+	}
+
+	float_t scale(const smt::darray<float_t, 1>& s) const {
+		float_t num = 0;
+		float_t den = 0;
+		for(std::size_t ii = 0; ii < _shells.size(); ++ii) {
+			num += _shells.count(ii)*_shells.mean(ii)*s(ii);
+			den += _shells.count(ii)*s(ii)*s(ii);
+		}
+
+		return std::max(num, float_t(0))/std::max(den, std::numeric_limits<float_t>::min());
+	}
+
+	float_t sumsq(const smt::shells<float_t>& shells) const {
+		float_t sumsq = 0;
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			sumsq += shells.sumsq(ii);
+		}
+
+		return sumsq;
+	}
 };
 
 template <typename float_t>
@@ -217,42 +648,302 @@ float_t microfa(const float_t& diff1, const float_t& diff2) {
 	}
 }
 
+// Cost function of MicroDTFunction for K voxels with common diffusion encoding
+// in lockstep, see neldermeadlockstep.h. The shell means are stored with the
+// lanes as the fastest-varying index, such that the spherical mean signal and
+// the residuals are evaluated by loops over lanes which may be vectorised.
+
+template <typename float_t, std::size_t K>
+class MicroDTLockstepFunction {
+public:
+	MicroDTLockstepFunction(const smt::diffenc<float_t>& dw,
+			const float_t& diffmax = 3.05e-3,
+			const bool& approx = false):
+				_diffmax(diffmax),
+				_approx(approx),
+				_diff1(K),
+				_diff2(K),
+				_signal(K) {
+		smt::darray<float_t, 1> y(dw.mapping.size());
+		std::fill(y.begin(), y.end(), float_t(0));
+		const smt::shells<float_t> shells(y, dw);
+		_bvalues.resize(shells.size());
+		_counts.resize(shells.size());
+		_means.resize(shells.size(), K);
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			_bvalues(ii) = shells.bvalue(ii);
+			_counts(ii) = shells.count(ii);
+		}
+		std::fill(_means.begin(), _means.end(), float_t(0));
+		for(std::size_t ll = 0; ll < K; ++ll) {
+			_y0(ll) = 0;
+			_sumsq(ll) = 0;
+		}
+	}
+
+	// Assigns the voxel of the given cost function to a lane.
+	void assign(const std::size_t& ll, const MicroDTFunction<float_t>& f) {
+		const smt::shells<float_t>& shells = f.shells();
+		smt::assert(shells.size() == _bvalues.size());
+		for(std::size_t ii = 0; ii < shells.size(); ++ii) {
+			_means(ii, ll) = shells.mean(ii);
+		}
+		_y0(ll) = f.y0();
+		_sumsq(ll) = f.sumsq();
+	}
+
+	void operator()(const smt::sarray<smt::sarray<float_t, 2>, K>& x, smt::sarray<float_t, K>& fval) const {
+		float_t* diff1 = _diff1.begin();
+		float_t* diff2 = _diff2.begin();
+		for(std::size_t ll = 0; ll < K; ++ll) {
+			const smt::sarray<float_t, 2> diff = microdtexpit(x(ll), _diffmax);
+			diff1[ll] = diff(0);
+			diff2[ll] = diff(1);
+			fval(ll) = _sumsq(ll);
+		}
+		const float_t* s = _signal.begin();
+		for(std::size_t ii = 0; ii < _bvalues.size(); ++ii) {
+			if(_bvalues(ii) > float_t(0)) {
+				if(_approx) {
+					smt::meansignal_approx(_bvalues(ii), _diff1, _diff2, _signal);
+				} else {
+					smt::meansignal(_bvalues(ii), _diff1, _diff2, _signal);
+				}
+				const float_t* mean = _means.begin()+ii*K;
+				for(std::size_t ll = 0; ll < K; ++ll) {
+					fval(ll) += _counts(ii)*smt::pow2(mean[ll]-_y0(ll)*s[ll]);
+				}
+			}
+		}
+	}
+
+	~MicroDTLockstepFunction() {
+	}
+
+private:
+	const float_t _diffmax;
+	const bool _approx;
+	smt::darray<float_t, 1> _bvalues;
+	smt::darray<std::size_t, 1> _counts;
+	smt::darray<float_t, 2> _means;
+	smt::sarray<float_t, K> _y0;
+	smt::sarray<float_t, K> _sumsq;
+	mutable smt::darray<float_t, 1> _diff1;
+	mutable smt::darray<float_t, 1> _diff2;
+	mutable smt::darray<float_t, 1> _signal;
+};
+
+// Estimation starting from the given parameters, e.g. those of a neighbouring
+// voxel, where the default starting point is used instead if the parameters
+// are not admissible or fit the data worse, see smt::start.
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmicrodt(const smt::darray<float_t, 1>& y,
+		const smt::diffenc<float_t>& dw,
+		const smt::sarray<float_t, 3>& x0,
+		smt::optinfo<float_t>& info,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const bool& varpro = false,
+		const smt::solver& method = smt::solver::neldermead,
+		const bool& approx = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	if(! b0 && dw.any_zero_bvalue()) {
+		MicroDTFunction<float_t> f(y, dw, diffmax, approx);
+
+		return f.trans0(smt::minimise(f, smt::start(f, smt::sarray<float_t, 2>{x0(0), x0(1)}), info, method, opt_rel, opt_abs, max_iter));
+	} else if(varpro) {
+		MicroDT0ProjFunction<float_t> f(y, dw, diffmax, approx);
+
+		return f.trans0(smt::minimise(f, smt::start(f, smt::sarray<float_t, 2>{x0(0), x0(1)}), info, method, opt_rel, opt_abs, max_iter));
+	} else {
+		MicroDT0Function<float_t> f(y, dw, diffmax, approx);
+
+		return f.trans(smt::minimise(f, smt::start(f, x0), info, method, opt_rel, opt_abs, max_iter));
+	}
+}
+
 template <typename float_t>
 smt::sarray<float_t, 3> fitmicrodt(const smt::darray<float_t, 1>& y,
 		const smt::diffenc<float_t>& dw,
 		const float_t& diffmax = 3.05e-3,
 		const bool& b0 = false,
+		const bool& varpro = false,
+		const smt::solver& method = smt::solver::neldermead,
+		const bool& approx = false,
 		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
-		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::optinfo<float_t> info;
 
-	// TODO: Random initialisation?
+	return fitmicrodt(y, dw, smt::sarray<float_t, 3>{0, 0, 0}, info, diffmax, b0, varpro, method, approx, opt_rel, opt_abs, max_iter);
+}
 
-	if(! b0 && dw.any_zero_bvalue()) {
-		MicroDTFunction<float_t> f(y, dw, diffmax);
-		smt::sNelderMead<float_t, 2, MicroDTFunction<float_t>> ssolver(f);
-		ssolver.init(f.init());
-		ssolver.solve(opt_rel, opt_abs);
-		smt::sarray<float_t, 3> x = f.trans0(ssolver());
-		if(x(0) < x(1)) {
-			const float_t tmp = x(0);
-			x(0) = x(1);
-			x(1) = tmp;
-		}
-
-		return x;
+// Mixed-precision estimation, where the given method iterates on the
+// single-precision cost function up to the resolution of single precision, and
+// the Levenberg-Marquardt method refines the estimates in the precision of
+// float_t to the given tolerance. The single-precision copy dw_single of the
+// diffusion encoding is provided by the caller, such that it is converted once
+// rather than per voxel. The iteration counts are summed over both stages.
+
+template <typename float_t>
+smt::sarray<float_t, 3> fitmicrodtmixed(const smt::darray<float_t, 1>& y,
+		const smt::diffenc<float_t>& dw,
+		const smt::diffenc<float>& dw_single,
+		const smt::sarray<float_t, 3>& x0,
+		smt::optinfo<float_t>& info,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const bool& varpro = false,
+		const smt::solver& method = smt::solver::neldermead,
+		const bool& approx = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::darray<float, 1> y_single(y.size(0));
+	for(std::size_t ii = 0; ii < y.size(0); ++ii) {
+		y_single(ii) = y(ii);
+	}
+	smt::optinfo<float> info_single;
+	const smt::sarray<float, 3> x_single = fitmicrodt(y_single, dw_single,
+			smt::sarray<float, 3>{float(x0(0)), float(x0(1)), float(x0(2))}, info_single,
+			float(diffmax), b0, varpro, method, approx,
+			100*std::numeric_limits<float>::epsilon(), std::numeric_limits<float>::epsilon(), max_iter);
+
+	const smt::sarray<float_t, 3> x = fitmicrodt(y, dw,
+			smt::sarray<float_t, 3>{x_single(0), x_single(1), x_single(2)}, info,
+			diffmax, b0, varpro, smt::solver::levmar, approx, opt_rel, opt_abs, max_iter);
+	info.iter += info_single.iter;
+	info.f_calls += info_single.f_calls;
+
+	return x;
+}
+
+// Lockstep estimation of a sequence of voxels with common diffusion encoding,
+// which are distributed over K lanes, where the zero b-value signal is given by
+// the mean over the measurements with zero b-value. The starting points are
+// chosen as in the voxelwise estimation, and each voxel follows the same
+// sequence of Nelder-Mead steps, see smt::sNelderMeadLockstep.
+
+template <typename float_t, std::size_t K>
+void fitmicrodtlockstep(const std::vector<smt::darray<float_t, 1>>& y,
+		const smt::diffenc<float_t>& dw,
+		const std::vector<smt::sarray<float_t, 3>>& x0,
+		std::vector<smt::sarray<float_t, 3>>& x,
+		std::vector<smt::optinfo<float_t>>& info,
+		const float_t& diffmax = 3.05e-3,
+		const bool& approx = false,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::assert(x0.size() == y.size());
+
+	const std::size_t n = y.size();
+	std::vector<MicroDTFunction<float_t>> f;
+	f.reserve(n);
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		f.emplace_back(y[ii], dw, diffmax, approx);
+	}
+	x.resize(n);
+	info.resize(n);
+
+	MicroDTLockstepFunction<float_t, K> g(dw, diffmax, approx);
+	smt::sNelderMeadLockstep<float_t, 2, K, MicroDTLockstepFunction<float_t, K>> solver(g);
+	smt::sarray<std::size_t, K> voxel;
+	for(std::size_t ll = 0; ll < K; ++ll) {
+		voxel(ll) = n;
+	}
+	std::size_t next = 0;
+	solver.solve([&](const std::size_t& ll) {
+		if(voxel(ll) < n) {
+			const std::size_t ii = voxel(ll);
+			x[ii] = f[ii].trans0(solver(ll));
+			info[ii].iter = solver.iter(ll);
+			info[ii].f_calls = solver.f_calls(ll);
+			info[ii].converged = solver.converged(ll);
+			info[ii].fval = solver.fval(ll);
+		}
+		voxel(ll) = n;
+		if(next < n) {
+			voxel(ll) = next;
+			g.assign(ll, f[next]);
+			solver.init(ll, smt::start(f[next], smt::sarray<float_t, 2>{x0[next](0), x0[next](1)}));
+			++next;
+		}
+	}, opt_rel, opt_abs, max_iter);
+}
+
+// Dictionary of the microscopic diffusion tensor model, see dictionary.h. The
+// estimates comprise the two microscopic diffusivities in no particular order
+// and the zero b-value signal.
+
+template <typename float_t>
+smt::dictionary<float_t> microdtdictionary(const smt::diffenc<float_t>& dw,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false,
+		const std::size_t& n = 100) {
+	return smt::dictionary<float_t>(dw, ! b0 && dw.any_zero_bvalue(),
+			[](const float_t& bvalue, const float_t& diff1, const float_t& diff2) {
+				return smt::meansignal(bvalue, diff1, diff2);
+			},
+			{float_t(0), float_t(0)}, {diffmax, diffmax}, n);
+}
+
+// Admissible estimate from that of microdtdictionary, i.e. with the
+// longitudinal diffusivity not less than the transverse one. The dictionary
+// also covers oblate tensors, and its estimates of nearly isotropic voxels are
+// poorly determined, whereas the least-squares estimate under this constraint
+// often lies on the isotropic ridge. Hence the isotropic diffusivity is
+// determined by a univariate search, and the isotropic tensor is reported if
+// it fits the data better than the ordered diffusivities of the dictionary.
+
+template <typename float_t>
+smt::sarray<float_t, 3> microdtadmissible(const smt::darray<float_t, 1>& y,
+		const smt::diffenc<float_t>& dw,
+		const smt::sarray<float_t, 3>& x,
+		const float_t& diffmax = 3.05e-3,
+		const bool& b0 = false) {
+	const smt::shells<float_t> sh(y, dw);
+	const bool fixed = ! b0 && dw.any_zero_bvalue();
+	const auto scale = [&](const float_t& diff1, const float_t& diff2) -> float_t {
+		if(fixed) {
+			return x(2);
+		}
+		float_t num = 0;
+		float_t den = 0;
+		for(std::size_t ii = 0; ii < sh.size(); ++ii) {
+			const float_t s = smt::meansignal(sh.bvalue(ii), diff1, diff2);
+			num += sh.count(ii)*sh.mean(ii)*s;
+			den += sh.count(ii)*s*s;
+		}
+		return std::max(num, float_t(0))/std::max(den, std::numeric_limits<float_t>::min());
+	};
+	const auto cost = [&](const float_t& diff1, const float_t& diff2) -> float_t {
+		const float_t s0 = scale(diff1, diff2);
+		float_t fval = 0;
+		for(std::size_t ii = 0; ii < sh.size(); ++ii) {
+			if(! fixed || sh.bvalue(ii) > float_t(0)) {
+				fval += sh.count(ii)*smt::pow2(sh.mean(ii)-s0*smt::meansignal(sh.bvalue(ii), diff1, diff2));
+			}
+		}
+		return fval;
+	};
+	const auto ridge = [&](const float_t& diff) -> float_t {
+		return cost(diff, diff);
+	};
+
+	smt::sBrent<float_t, decltype(ridge)> search(ridge);
+	search.init(smt::micromd(x(0), x(1)), float_t(0), diffmax);
+	search.solve();
+	const float_t diff = search();
+	const float_t diff1 = std::max(x(0), x(1));
+	const float_t diff2 = std::min(x(0), x(1));
+	if(search.fval() < cost(diff1, diff2)) {
+		return smt::sarray<float_t, 3>{diff, diff, scale(diff, diff)};
 	} else {
-		MicroDT0Function<float_t> f(y, dw, diffmax);
-		smt::sNelderMead<float_t, 3, MicroDT0Function<float_t>> ssolver(f);
-		ssolver.init(f.init());
-		ssolver.solve(opt_rel, opt_abs);
-		smt::sarray<float_t, 3> x = f.trans(ssolver());
-		if(x(0) < x(1)) {
-			const float_t tmp = x(0);
-			x(0) = x(1);
-			x(1) = tmp;
-		}
-
-		return x;
+		return smt::sarray<float_t, 3>{diff1, diff2, scale(diff1, diff2)};
 	}
 }
 
@@ -0,0 +1,367 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef _GZINDEX_H
+#define _GZINDEX_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "env.h"
+
+namespace smt {
+
+// Index of access points into a gzip file for random access (after zran.c of
+// the zlib distribution). An access point records the position of a deflate
+// block boundary in the compressed and the uncompressed stream, together with
+// the preceding 32 KiB of uncompressed data, which serve as dictionary when
+// inflating from that point. The start of each gzip member is an access point
+// without dictionary, such that concatenated and blocked (BGZF) files are
+// supported too. The points are spaced about span bytes of uncompressed data
+// apart, thus a read inflates at most span bytes in excess of the requested
+// range.
+//
+// The index is persisted in a sidecar file, which is valid as long as the size
+// and the modification time of the gzip file are unchanged.
+
+class gzindex {
+public:
+	gzindex():
+			_filesize(0),
+			_mtime_sec(0),
+			_mtime_nsec(0),
+			_points() {
+	}
+
+	explicit operator bool() const {
+		return ! _points.empty();
+	}
+
+	bool build(const std::string& filename, const std::size_t& span = 1048576) {
+		_points.clear();
+		if(! stat(filename)) {
+			return false;
+		}
+		std::FILE* fin = std::fopen(filename.c_str(), "rb");
+		if(fin == nullptr) {
+			return false;
+		}
+
+		z_stream strm;
+		std::memset(&strm, 0, sizeof(z_stream));
+		if(inflateInit2(&strm, 16+MAX_WBITS) != Z_OK) {
+			std::fclose(fin);
+			return false;
+		}
+
+		std::vector<unsigned char> input(chunk);
+		std::vector<unsigned char> window(winsize);
+		std::uint64_t totin = 0;
+		std::uint64_t totout = 0;
+		std::uint64_t last = 0;
+		bool start = true;
+		bool ended = false;
+		bool valid = true;
+		strm.avail_out = 0;
+		while(valid) {
+			if(strm.avail_in == 0) {
+				strm.avail_in = std::fread(input.data(), 1, chunk, fin);
+				strm.next_in = input.data();
+				if(strm.avail_in == 0) {
+					valid = ended && ! std::ferror(fin);
+					break;
+				}
+			}
+			if(start) {
+				// Member header
+				if(strm.avail_in == 1) {
+					input[0] = strm.next_in[0];
+					strm.avail_in = 1+std::fread(input.data()+1, 1, chunk-1, fin);
+					strm.next_in = input.data();
+				}
+				if(strm.avail_in < 2 || strm.next_in[0] != 0x1f || strm.next_in[1] != 0x8b) {
+					// Trailing garbage, e.g. zero padding, is ignored as by gzip.
+					valid = ended;
+					break;
+				}
+				_points.push_back(point{totout, totin, -1, std::vector<unsigned char>()});
+				last = totout;
+				start = false;
+			}
+			if(strm.avail_out == 0) {
+				strm.avail_out = winsize;
+				strm.next_out = window.data();
+			}
+			totin += strm.avail_in;
+			totout += strm.avail_out;
+			const int ret = inflate(&strm, Z_BLOCK);
+			totin -= strm.avail_in;
+			totout -= strm.avail_out;
+			if(ret == Z_STREAM_END) {
+				ended = true;
+				start = true;
+				inflateReset(&strm);
+				continue;
+			}
+			if(ret != Z_OK && ret != Z_BUF_ERROR) {
+				valid = false;
+				break;
+			}
+			ended = false;
+			if((strm.data_type & 128) != 0 && (strm.data_type & 64) == 0 && totout-last > span) {
+				point p{totout, totin, strm.data_type & 7, std::vector<unsigned char>(winsize)};
+				const std::size_t left = strm.avail_out;
+				std::copy(window.begin()+(winsize-left), window.end(), p.window.begin());
+				std::copy(window.begin(), window.begin()+(winsize-left), p.window.begin()+left);
+				_points.push_back(std::move(p));
+				last = totout;
+			}
+		}
+
+		inflateEnd(&strm);
+		std::fclose(fin);
+		if(! valid) {
+			_points.clear();
+		}
+
+		return valid;
+	}
+
+	bool load(const std::string& indexname, const std::string& filename) {
+		_points.clear();
+		if(! stat(filename)) {
+			return false;
+		}
+		std::FILE* fin = std::fopen(indexname.c_str(), "rb");
+		if(fin == nullptr) {
+			return false;
+		}
+
+		char magic[8];
+		std::uint64_t header[4];
+		bool valid = std::fread(magic, 8, 1, fin) == 1 && std::memcmp(magic, "smtgzix1", 8) == 0
+				&& std::fread(header, sizeof(header), 1, fin) == 1
+				&& header[0] == _filesize && header[1] == std::uint64_t(_mtime_sec) && header[2] == std::uint64_t(_mtime_nsec);
+		for(std::uint64_t ii = 0; valid && ii < header[3]; ++ii) {
+			point p;
+			std::int64_t bits;
+			valid = std::fread(&p.out, sizeof(p.out), 1, fin) == 1 && std::fread(&p.in, sizeof(p.in), 1, fin) == 1 && std::fread(&bits, sizeof(bits), 1, fin) == 1
+					&& bits >= -1 && bits <= 7 && p.in < _filesize
+					&& ((_points.empty())? p.out == 0 : p.out >= _points.back().out);
+			if(valid) {
+				p.bits = bits;
+				if(p.bits >= 0) {
+					p.window.resize(winsize);
+					valid = std::fread(p.window.data(), 1, winsize, fin) == winsize;
+				}
+				_points.push_back(std::move(p));
+			}
+		}
+		std::fclose(fin);
+		if(! valid) {
+			_points.clear();
+		}
+
+		return valid;
+	}
+
+	bool save(const std::string& indexname) const {
+		// The index is written under a temporary name and renamed such that
+		// concurrent readers never see a partial file.
+
+		const std::string tmpname = indexname + ".tmp" + std::to_string(getpid());
+		std::FILE* fout = std::fopen(tmpname.c_str(), "wb");
+		if(fout == nullptr) {
+			return false;
+		}
+
+		const std::uint64_t header[4] = {_filesize, std::uint64_t(_mtime_sec), std::uint64_t(_mtime_nsec), _points.size()};
+		bool valid = std::fwrite("smtgzix1", 8, 1, fout) == 1 && std::fwrite(header, sizeof(header), 1, fout) == 1;
+		for(const point& p : _points) {
+			const std::int64_t bits = p.bits;
+			valid = valid && std::fwrite(&p.out, sizeof(p.out), 1, fout) == 1 && std::fwrite(&p.in, sizeof(p.in), 1, fout) == 1 && std::fwrite(&bits, sizeof(bits), 1, fout) == 1
+					&& (p.bits < 0 || std::fwrite(p.window.data(), 1, winsize, fout) == winsize);
+		}
+		valid = (std::fclose(fout) == 0) && valid && std::rename(tmpname.c_str(), indexname.c_str()) == 0;
+		if(! valid) {
+			std::remove(tmpname.c_str());
+		}
+
+		return valid;
+	}
+
+	// Range of the uncompressed stream to be decompressed into out.
+	struct range {
+		std::uint64_t offset;
+		std::size_t size;
+		unsigned char* out;
+	};
+
+	// Decompresses the given ranges in ascending order. The decompression
+	// continues from the previous range unless a later access point precedes
+	// the next range, such that the excess data inflated is bounded by the
+	// span and never exceeds the whole stream.
+	bool read(std::FILE* fin, const std::vector<range>& ranges) const {
+		if(_points.empty()) {
+			return false;
+		}
+
+		z_stream strm;
+		std::memset(&strm, 0, sizeof(z_stream));
+		bool active = false;
+		bool raw = false;
+		std::size_t trailer = 0;
+		std::uint64_t pos = 0;
+		std::vector<unsigned char> input(chunk);
+		std::vector<unsigned char> discard(winsize);
+		bool valid = true;
+		for(const range& r : ranges) {
+			const point& p = *(std::upper_bound(_points.begin(), _points.end(), r.offset, [](const std::uint64_t& off, const point& q) {
+				return off < q.out;
+			})-1);
+			if(! active || pos > r.offset || p.out > pos) {
+				if(active) {
+					inflateEnd(&strm);
+				}
+				std::memset(&strm, 0, sizeof(z_stream));
+				raw = p.bits >= 0;
+				trailer = 0;
+				pos = p.out;
+				if(! (active = inflateInit2(&strm, (raw)? -MAX_WBITS : 16+MAX_WBITS) == Z_OK)) {
+					return false;
+				}
+				valid = fseeko(fin, p.in-((p.bits > 0)? 1 : 0), SEEK_SET) == 0;
+				if(valid && p.bits > 0) {
+					const int ch = std::getc(fin);
+					valid = ch != EOF && inflatePrime(&strm, p.bits, ch >> (8-p.bits)) == Z_OK;
+				}
+				if(valid && raw) {
+					valid = inflateSetDictionary(&strm, p.window.data(), winsize) == Z_OK;
+				}
+			}
+
+			std::size_t done = 0;
+			while(valid && done < r.size) {
+				if(strm.avail_in == 0) {
+					strm.avail_in = std::fread(input.data(), 1, chunk, fin);
+					strm.next_in = input.data();
+					if(strm.avail_in == 0) {
+						valid = false;
+						break;
+					}
+				}
+				if(trailer > 0) {
+					// Trailer of a member entered through a raw access point
+					const std::size_t n = std::min<std::size_t>(trailer, strm.avail_in);
+					strm.next_in += n;
+					strm.avail_in -= n;
+					trailer -= n;
+					if(trailer == 0) {
+						valid = inflateReset2(&strm, 16+MAX_WBITS) == Z_OK;
+					}
+					continue;
+				}
+				if(pos < r.offset) {
+					strm.next_out = discard.data();
+					strm.avail_out = std::min<std::uint64_t>(r.offset-pos, winsize);
+				} else {
+					strm.next_out = r.out+done;
+					strm.avail_out = std::min<std::size_t>(r.size-done, UINT_MAX);
+				}
+				const unsigned int avail = strm.avail_out;
+				const int ret = inflate(&strm, Z_NO_FLUSH);
+				if(pos >= r.offset) {
+					done += avail-strm.avail_out;
+				}
+				pos += avail-strm.avail_out;
+				if(ret == Z_STREAM_END) {
+					if(raw) {
+						raw = false;
+						trailer = 8;
+					} else {
+						valid = inflateReset(&strm) == Z_OK;
+					}
+				} else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+					valid = false;
+				}
+			}
+			if(! valid) {
+				break;
+			}
+		}
+		if(active) {
+			inflateEnd(&strm);
+		}
+
+		return valid;
+	}
+
+private:
+	static const std::size_t chunk = 16384;
+	static const std::size_t winsize = 32768;
+
+	struct point {
+		std::uint64_t out;
+		std::uint64_t in;
+		int bits;
+		std::vector<unsigned char> window;
+	};
+
+	std::uint64_t _filesize;
+	std::int64_t _mtime_sec;
+	std::int64_t _mtime_nsec;
+	std::vector<point> _points;
+
+	bool stat(const std::string& filename) {
+		struct ::stat st;
+		if(::stat(filename.c_str(), &st) != 0) {
+			return false;
+		}
+		_filesize = st.st_size;
+		smt::mtime(st, _mtime_sec, _mtime_nsec);
+
+		return true;
+	}
+};
+
+const std::size_t gzindex::chunk;
+const std::size_t gzindex::winsize;
+
+} // smt
+
+#endif // _GZINDEX_H
@@ -0,0 +1,153 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _KDTREE_H
+#define _KDTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+
+#include "darray.h"
+#include "debug.h"
+#include "pow.h"
+
+namespace smt {
+
+// Exact nearest-neighbour search with respect to the Euclidean distance. The
+// points are arranged as an implicit, balanced k-d tree, where each subrange
+// of the permuted point indices is split at its median along the coordinate
+// with the greatest spread.
+
+template <typename float_t>
+class kdtree {
+public:
+	kdtree() {}
+
+	kdtree(const smt::darray<float_t, 2>& points):
+			_points(points),
+			_idx(points.size(0)),
+			_dim(points.size(0)) {
+		smt::assert(points.size(0) > 0 && points.size(1) > 0);
+
+		std::iota(_idx.begin(), _idx.end(), 0);
+		build(0, _idx.size());
+	}
+
+	std::size_t size() const {
+		return _points.size(0);
+	}
+
+	std::size_t dim() const {
+		return _points.size(1);
+	}
+
+	// Index of the point closest to the query point q of length dim().
+	std::size_t nearest(const float_t* q) const {
+		std::size_t best_idx = 0;
+		float_t best_dist = std::numeric_limits<float_t>::max();
+		search(q, 0, _idx.size(), best_idx, best_dist);
+
+		return best_idx;
+	}
+
+	~kdtree() {
+	}
+
+private:
+	const smt::darray<float_t, 2> _points;
+	smt::darray<std::size_t, 1> _idx;
+	smt::darray<std::size_t, 1> _dim;
+
+	void build(const std::size_t lo, const std::size_t hi) {
+		if(hi-lo < 2) {
+			return;
+		}
+
+		std::size_t dd = 0;
+		float_t spread = -1;
+		for(std::size_t jj = 0; jj < dim(); ++jj) {
+			float_t min = std::numeric_limits<float_t>::max();
+			float_t max = -std::numeric_limits<float_t>::max();
+			for(std::size_t ii = lo; ii < hi; ++ii) {
+				min = std::min(min, _points(_idx(ii), jj));
+				max = std::max(max, _points(_idx(ii), jj));
+			}
+			if(max-min > spread) {
+				spread = max-min;
+				dd = jj;
+			}
+		}
+
+		const std::size_t mid = lo+(hi-lo)/2;
+		std::nth_element(_idx.begin()+lo, _idx.begin()+mid, _idx.begin()+hi, [&](const std::size_t& ii, const std::size_t& jj) {
+			return _points(ii, dd) < _points(jj, dd);
+		});
+		_dim(mid) = dd;
+
+		build(lo, mid);
+		build(mid+1, hi);
+	}
+
+	void search(const float_t* q, const std::size_t lo, const std::size_t hi, std::size_t& best_idx, float_t& best_dist) const {
+		if(hi <= lo) {
+			return;
+		}
+
+		const std::size_t mid = lo+(hi-lo)/2;
+		const float_t* p = &_points(_idx(mid), 0);
+		float_t dist = 0;
+		for(std::size_t jj = 0; jj < dim(); ++jj) {
+			dist += smt::pow2(q[jj]-p[jj]);
+		}
+		if(dist < best_dist) {
+			best_dist = dist;
+			best_idx = _idx(mid);
+		}
+
+		if(hi-lo == 1) {
+			return;
+		}
+
+		const float_t diff = q[_dim(mid)]-p[_dim(mid)];
+		if(diff < 0) {
+			search(q, lo, mid, best_idx, best_dist);
+			if(smt::pow2(diff) < best_dist) {
+				search(q, mid+1, hi, best_idx, best_dist);
+			}
+		} else {
+			search(q, mid+1, hi, best_idx, best_dist);
+			if(smt::pow2(diff) < best_dist) {
+				search(q, lo, mid, best_idx, best_dist);
+			}
+		}
+	}
+};
+
+} // smt
+
+#endif // _KDTREE_H
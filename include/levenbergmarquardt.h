@@ -0,0 +1,223 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _LEVENBERGMARQUARDT_H
+#define _LEVENBERGMARQUARDT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include "darray.h"
+#include "debug.h"
+#include "pow.h"
+#include "sarray.h"
+
+namespace smt {
+
+//
+// Madsen K, Nielsen HB and Tingleff O: Methods for Non-Linear Least Squares
+// Problems. Technical University of Denmark, 2nd edition, 2004.
+//
+// Nielsen HB: Damping Parameter in Marquardt's Method. Technical Report
+// IMM-REP-1999-05, Technical University of Denmark, 1999.
+//
+// The function object provides the cost function value via operator(), the
+// number of residuals via residuals() and the residuals together with their
+// analytic Jacobian via jacobian(). The cost function value is assumed to
+// equal the sum of squared residuals up to an additive constant.
+//
+
+template <typename float_t, std::size_t N, typename function_t>
+class sLevenbergMarquardt {
+public:
+	sLevenbergMarquardt(const function_t& function):
+			_tau(1e-3),
+			_function(function),
+			_r(function.residuals()),
+			_J(function.residuals()),
+			_iter(0),
+			_f_calls(0) {
+		static_assert(N > 0, "N > 0");
+	}
+
+	void init(const smt::sarray<float_t, N>& x) {
+		_x = x;
+		_fval = _function(_x);
+	}
+
+	bool solve(const float_t tol_rel = 100*std::numeric_limits<float_t>::epsilon(),
+			const float_t tol_abs = std::numeric_limits<float_t>::epsilon(),
+			const std::size_t max_iter = 10000) {
+		_iter = 0;
+		_f_calls = 1;
+
+		_function.jacobian(_x, _r, _J);
+		_f_calls += 1;
+		smt::sarray<float_t, N, N> A;
+		smt::sarray<float_t, N> g;
+		normal(A, g);
+
+		float_t mu = 0;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			mu = std::max(mu, A(ii, ii));
+		}
+		mu *= _tau;
+		float_t nu = 2;
+
+		bool converged = (smt::normInf(g) == float_t(0));
+		while((! converged) && _iter < max_iter) {
+			smt::sarray<float_t, N> h;
+			if(! step(A, g, mu, h)) {
+				mu *= nu;
+				nu *= 2;
+				++_iter;
+				continue;
+			}
+
+			if(smt::normInf(h) <= std::max(tol_abs, tol_rel*smt::normInf(_x))) {
+				converged = true;
+				break;
+			}
+
+			const smt::sarray<float_t, N> x_new = _x+h;
+			const float_t fval_new = _function(x_new);
+			_f_calls += 1;
+
+			// predicted reduction of the quadratic model
+			float_t pred = 0;
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				pred += h(ii)*(mu*h(ii)-g(ii));
+			}
+			const float_t rho = (_fval-fval_new)/pred;
+
+			if(pred > float_t(0) && rho > float_t(0)) {
+				const bool small = std::abs(_fval-fval_new) <= std::max(tol_abs, tol_rel*std::abs(fval_new));
+				_x = x_new;
+				_fval = fval_new;
+				_function.jacobian(_x, _r, _J);
+				_f_calls += 1;
+				normal(A, g);
+				const float_t tmp = float_t(2)*rho-float_t(1);
+				mu *= std::max(float_t(1)/float_t(3), float_t(1)-tmp*tmp*tmp);
+				nu = 2;
+				if(small || smt::normInf(g) == float_t(0)) {
+					converged = true;
+				}
+			} else {
+				mu *= nu;
+				nu *= 2;
+			}
+			++_iter;
+		}
+
+		return converged;
+	}
+
+	smt::sarray<float_t, N> operator()() const {
+		return _x;
+	}
+
+	std::size_t iter() const {
+		return _iter;
+	}
+
+	std::size_t f_calls() const {
+		return _f_calls;
+	}
+
+	float_t fval() const {
+		return _fval;
+	}
+
+private:
+	const float_t _tau; // initial damping relative to the curvature
+	const function_t& _function;
+
+	smt::sarray<float_t, N> _x;
+	float_t _fval;
+	smt::darray<float_t, 1> _r;
+	smt::darray<smt::sarray<float_t, N>, 1> _J;
+	std::size_t _iter;
+	std::size_t _f_calls;
+
+	void normal(smt::sarray<float_t, N, N>& A, smt::sarray<float_t, N>& g) const {
+		A = 0;
+		g = 0;
+		for(std::size_t kk = 0; kk < _r.size(); ++kk) {
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				for(std::size_t jj = 0; jj < N; ++jj) {
+					A(ii, jj) += _J(kk)(ii)*_J(kk)(jj);
+				}
+				g(ii) += _J(kk)(ii)*_r(kk);
+			}
+		}
+	}
+
+	// Solves (A+mu*I)*h = -g by Cholesky decomposition.
+	bool step(const smt::sarray<float_t, N, N>& A, const smt::sarray<float_t, N>& g, const float_t& mu, smt::sarray<float_t, N>& h) const {
+		smt::sarray<float_t, N, N> L;
+		L = 0;
+		for(std::size_t jj = 0; jj < N; ++jj) {
+			float_t tmp = A(jj, jj)+mu;
+			for(std::size_t kk = 0; kk < jj; ++kk) {
+				tmp -= smt::pow2(L(jj, kk));
+			}
+			if(! (tmp > float_t(0))) {
+				return false;
+			}
+			L(jj, jj) = std::sqrt(tmp);
+			for(std::size_t ii = jj+1; ii < N; ++ii) {
+				float_t tmp = A(ii, jj);
+				for(std::size_t kk = 0; kk < jj; ++kk) {
+					tmp -= L(ii, kk)*L(jj, kk);
+				}
+				L(ii, jj) = tmp/L(jj, jj);
+			}
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			float_t tmp = -g(ii);
+			for(std::size_t kk = 0; kk < ii; ++kk) {
+				tmp -= L(ii, kk)*h(kk);
+			}
+			h(ii) = tmp/L(ii, ii);
+		}
+		for(std::size_t ii = N; ii-- > 0;) {
+			float_t tmp = h(ii);
+			for(std::size_t kk = ii+1; kk < N; ++kk) {
+				tmp -= L(kk, ii)*h(kk);
+			}
+			h(ii) = tmp/L(ii, ii);
+		}
+
+		return true;
+	}
+};
+
+} // smt
+
+#endif // _LEVENBERGMARQUARDT_H
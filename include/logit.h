@@ -30,11 +30,26 @@
 #include <cmath>
 #include <limits>
 
+#include "vmath.h"
+
 namespace smt {
 
+// Interior of the range (0, max) whose logit is finite, which bounds the
+// parameters for solvers operating on the natural scale.
+
+template <typename float_t>
+float_t logit_lower(const float_t max = 1) {
+	return std::sqrt(std::numeric_limits<float_t>::epsilon())*max;
+}
+
+template <typename float_t>
+float_t logit_upper(const float_t max = 1) {
+	return (float_t(1)-std::sqrt(std::numeric_limits<float_t>::epsilon()))*max;
+}
+
 template <typename float_t>
 float_t logit(const float_t x, const float_t max = 1) {
-	return std::log(x)-std::log(max-x);
+	return smt::vlog(x)-smt::vlog(max-x);
 }
 
 template <typename float_t>
@@ -44,10 +59,17 @@ float_t expit(const float_t x, const float_t max = 1) {
 	if(x > num_max) {
 		return max;
 	} else {
-		return max*std::exp(x)/(float_t(1)+std::exp(x));
+		return max*smt::vexp(x)/(float_t(1)+smt::vexp(x));
 	}
 }
 
+template <typename float_t>
+float_t dexpit(const float_t x, const float_t max = 1) {
+	const float_t y = expit(x, max);
+
+	return y*(max-y)/max;
+}
+
 } // smt
 
 #endif // _LOGIT_H
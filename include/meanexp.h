@@ -0,0 +1,135 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _MEANEXP_H
+#define _MEANEXP_H
+
+#include <array>
+#include <cmath>
+
+#include "chebychev.h"
+
+namespace smt {
+
+// Mean of exp(-x*u^2) over u in [0, 1], i.e. sqrt(pi)*erf(sqrt(x))/(2*sqrt(x))
+// for x >= 0, which is the erf(x)/x factor of the spherical mean signal. The
+// function is approximated by truncated Chebyshev series on [0, 2], [2, 6] and
+// [6, 16] and by sqrt(pi)/(2*sqrt(x)) beyond, avoiding the call to erf. The
+// maximum relative error is 2.3e-8 in double precision and 2.8e-7 in single
+// precision with the -Ofast flags of the build (2.0e-7 without -ffast-math),
+// where the latter is dominated by rounding.
+
+float meanexp(float x) {
+	const std::array<float, 8> A = {
+			-8.81130040621790914306e-8f,
+			1.45141080807944006105e-6f,
+			-2.11130163224419324956e-5f,
+			2.67067676644633671037e-4f,
+			-2.88484997097379625153e-3f,
+			2.61224838377889304053e-2f,
+			-1.98021945333743593087e-1f,
+			1.54536199122044126675e0f};
+	const std::array<float, 9> B = {
+			9.63609128872210046150e-8f,
+			-9.42073546702947365439e-7f,
+			8.37787973803539311689e-6f,
+			-6.74172401041983458290e-5f,
+			4.89352096693263178065e-4f,
+			-3.21221732655585859306e-3f,
+			1.94093121568669549348e-2f,
+			-1.14987343933702745868e-1f,
+			9.19937875464319598784e-1f};
+	const std::array<float, 11> C = {
+			2.93909383356980978060e-8f,
+			-1.62740086507062384891e-7f,
+			8.61961505165597036067e-7f,
+			-4.38919339347171551718e-6f,
+			2.16487830154269520898e-5f,
+			-1.04501119671146643856e-4f,
+			5.00453337018904849745e-4f,
+			-2.42120846478699339524e-3f,
+			1.21661689561421027667e-2f,
+			-6.74954429911603093206e-2f,
+			5.57786548744665822142e-1f};
+
+	if(x < 2.0f) {
+		return smt::chebeval(x-1.0f, A);
+	} else if(x < 6.0f) {
+		return smt::chebeval(0.5f*x-2.0f, B);
+	} else if(x < 16.0f) {
+		return smt::chebeval(0.2f*x-2.2f, C);
+	} else {
+		return 0.886226925452758013649f/std::sqrt(x);
+	}
+}
+
+double meanexp(double x) {
+	const std::array<double, 8> A = {
+			-8.81130040621790914306e-8,
+			1.45141080807944006105e-6,
+			-2.11130163224419324956e-5,
+			2.67067676644633671037e-4,
+			-2.88484997097379625153e-3,
+			2.61224838377889304053e-2,
+			-1.98021945333743593087e-1,
+			1.54536199122044126675e0};
+	const std::array<double, 9> B = {
+			9.63609128872210046150e-8,
+			-9.42073546702947365439e-7,
+			8.37787973803539311689e-6,
+			-6.74172401041983458290e-5,
+			4.89352096693263178065e-4,
+			-3.21221732655585859306e-3,
+			1.94093121568669549348e-2,
+			-1.14987343933702745868e-1,
+			9.19937875464319598784e-1};
+	const std::array<double, 11> C = {
+			2.93909383356980978060e-8,
+			-1.62740086507062384891e-7,
+			8.61961505165597036067e-7,
+			-4.38919339347171551718e-6,
+			2.16487830154269520898e-5,
+			-1.04501119671146643856e-4,
+			5.00453337018904849745e-4,
+			-2.42120846478699339524e-3,
+			1.21661689561421027667e-2,
+			-6.74954429911603093206e-2,
+			5.57786548744665822142e-1};
+
+	if(x < 2.0) {
+		return smt::chebeval(x-1.0, A);
+	} else if(x < 6.0) {
+		return smt::chebeval(0.5*x-2.0, B);
+	} else if(x < 16.0) {
+		return smt::chebeval(0.2*x-2.2, C);
+	} else {
+		return 0.886226925452758013649/std::sqrt(x);
+	}
+}
+
+} // smt
+
+#endif // _MEANEXP_H
@@ -27,18 +27,23 @@
 #ifndef _MEANSIGNAL_H
 #define _MEANSIGNAL_H
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <limits>
 
+#include "darray.h"
 #include "debug.h"
+#include "meanexp.h"
+#include "sarray.h"
+#include "vmath.h"
 
 namespace smt {
 
-// TODO: The order of lambda1 and lambda2 is irrelevant. We assume that the
-// greater value indicates the longitudinal microscopic diffusivity, which may
-// give rise to a discontinuity in the derivatives.
-
-// TODO: Efficient computation of erf
+// The order of lambda1 and lambda2 is irrelevant. We assume that the greater
+// value indicates the longitudinal microscopic diffusivity, which gives rise to
+// a discontinuity in the derivatives at lambda1 == lambda2. The model fits avoid
+// it by an ordered parametrisation, see smt::microdtexpit.
 
 template<typename float_t>
 float_t meansignal(const float_t bvalue, const float_t lambda1, const float_t lambda2) {
@@ -46,11 +51,11 @@ float_t meansignal(const float_t bvalue, const float_t lambda1, const float_t la
 		if(bvalue == 0) {
 			return float_t(1);
 		} else {
-			const float_t tmp = std::sqrt(bvalue*(lambda1-lambda2));
-			return std::sqrt(float_t(M_PI))*std::exp(-bvalue*lambda2)*erf(tmp)/(float_t(2)*tmp);
+			const float_t tmp = smt::vsqrt(bvalue*(lambda1-lambda2));
+			return std::sqrt(float_t(M_PI))*smt::vexp(-bvalue*lambda2)*smt::verf(tmp)/(float_t(2)*tmp);
 		}
 	} else if(lambda1 == lambda2) {
-		return std::exp(-bvalue*lambda1);
+		return smt::vexp(-bvalue*lambda1);
 	} else if(lambda1 < lambda2) {
 		return meansignal(bvalue, lambda2, lambda1);
 	} else {
@@ -60,6 +65,118 @@ float_t meansignal(const float_t bvalue, const float_t lambda1, const float_t la
 	return std::numeric_limits<float_t>::quiet_NaN(); // unreachable
 }
 
+// Batched evaluation of the spherical mean signal for an array of b-values or
+// an array of (lambda1, lambda2) pairs. The loops are free of branches, such
+// that the compiler may vectorise them including the calls to exp and erf,
+// e.g. using the vector math library of glibc (version 2.35 or later) for
+// SSE2, AVX2 or AVX-512, or using the polynomial kernels of vmath.h. The
+// singularity at lambda1 == lambda2 is removed by bounding the argument of
+// erf(x)/x from below by the smallest normalised number, where the ratio
+// equals its limit 2/sqrt(pi) to machine precision.
+
+template<typename float_t>
+void meansignal(const smt::darray<float_t, 1>& bvalues, const float_t lambda1, const float_t lambda2, smt::darray<float_t, 1>& s) {
+	smt::assert(bvalues.size() == s.size());
+
+	const float_t* b = bvalues.begin();
+	float_t* out = s.begin();
+	const std::size_t n = s.size();
+	const float_t lmax = std::max(lambda1, lambda2);
+	const float_t lmin = std::min(lambda1, lambda2);
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		const float_t tmp = smt::vsqrt(std::max(b[ii]*(lmax-lmin), std::numeric_limits<float_t>::min()));
+		out[ii] = std::sqrt(float_t(M_PI))*smt::vexp(-b[ii]*lmin)*smt::verf(tmp)/(float_t(2)*tmp);
+	}
+}
+
+template<typename float_t>
+void meansignal(const float_t bvalue, const smt::darray<float_t, 1>& lambda1, const smt::darray<float_t, 1>& lambda2, smt::darray<float_t, 1>& s) {
+	smt::assert(lambda1.size() == s.size() && lambda2.size() == s.size());
+
+	const float_t* l1 = lambda1.begin();
+	const float_t* l2 = lambda2.begin();
+	float_t* out = s.begin();
+	const std::size_t n = s.size();
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		const float_t lmax = std::max(l1[ii], l2[ii]);
+		const float_t lmin = std::min(l1[ii], l2[ii]);
+		const float_t tmp = smt::vsqrt(std::max(bvalue*(lmax-lmin), std::numeric_limits<float_t>::min()));
+		out[ii] = std::sqrt(float_t(M_PI))*smt::vexp(-bvalue*lmin)*smt::verf(tmp)/(float_t(2)*tmp);
+	}
+}
+
+// Approximate spherical mean signal, where the erf(x)/x factor is evaluated by
+// smt::meanexp. The relative error is below the resolution of single-precision
+// floating-point numbers.
+
+template<typename float_t>
+float_t meansignal_approx(const float_t bvalue, const float_t lambda1, const float_t lambda2) {
+	const float_t lmax = std::max(lambda1, lambda2);
+	const float_t lmin = std::min(lambda1, lambda2);
+	return smt::vexp(-bvalue*lmin)*smt::meanexp(bvalue*(lmax-lmin));
+}
+
+template<typename float_t>
+void meansignal_approx(const smt::darray<float_t, 1>& bvalues, const float_t lambda1, const float_t lambda2, smt::darray<float_t, 1>& s) {
+	smt::assert(bvalues.size() == s.size());
+
+	const float_t* b = bvalues.begin();
+	float_t* out = s.begin();
+	const std::size_t n = s.size();
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		out[ii] = meansignal_approx(b[ii], lambda1, lambda2);
+	}
+}
+
+template<typename float_t>
+void meansignal_approx(const float_t bvalue, const smt::darray<float_t, 1>& lambda1, const smt::darray<float_t, 1>& lambda2, smt::darray<float_t, 1>& s) {
+	smt::assert(lambda1.size() == s.size() && lambda2.size() == s.size());
+
+	const float_t* l1 = lambda1.begin();
+	const float_t* l2 = lambda2.begin();
+	float_t* out = s.begin();
+	const std::size_t n = s.size();
+	for(std::size_t ii = 0; ii < n; ++ii) {
+		out[ii] = meansignal_approx(bvalue, l1[ii], l2[ii]);
+	}
+}
+
+// Partial derivatives of the spherical mean signal with respect to lambda1 and
+// lambda2. With x = b*(lambda1-lambda2), one obtains
+//   d/dlambda1 = b*exp(-b*lambda2)*(exp(-x)-g(x))/(2*x),
+//   d/dlambda2 = -b*meansignal-d/dlambda1,
+// where g(x) = sqrt(pi)*erf(sqrt(x))/(2*sqrt(x)). The ratio is replaced by its
+// Taylor series for small x to avoid cancellation.
+
+template<typename float_t>
+smt::sarray<float_t, 2> dmeansignal(const float_t bvalue, const float_t lambda1, const float_t lambda2) {
+	if(lambda1 > lambda2) {
+		const float_t x = bvalue*(lambda1-lambda2);
+		const float_t e2 = smt::vexp(-bvalue*lambda2);
+		float_t h;
+		if(x < std::sqrt(std::sqrt(std::numeric_limits<float_t>::epsilon()))) {
+			h = -float_t(1)/float_t(3)+x*(float_t(1)/float_t(5)-x*(float_t(1)/float_t(14)-x/float_t(54)));
+		} else {
+			const float_t tmp = smt::vsqrt(x);
+			const float_t g = std::sqrt(float_t(M_PI))*smt::verf(tmp)/(float_t(2)*tmp);
+			h = (smt::vexp(-x)-g)/(float_t(2)*x);
+		}
+		const float_t d1 = bvalue*e2*h;
+		const float_t d2 = -bvalue*meansignal(bvalue, lambda1, lambda2)-d1;
+		return {d1, d2};
+	} else if(lambda1 == lambda2) {
+		const float_t tmp = bvalue*smt::vexp(-bvalue*lambda1);
+		return {-tmp/float_t(3), -float_t(2)*tmp/float_t(3)};
+	} else if(lambda1 < lambda2) {
+		const smt::sarray<float_t, 2> tmp = dmeansignal(bvalue, lambda2, lambda1);
+		return {tmp(1), tmp(0)};
+	} else {
+		smt::assert(false);
+	}
+
+	return std::numeric_limits<float_t>::quiet_NaN(); // unreachable
+}
+
 } // smt
 
 #endif // _MEANSIGNAL_H
@@ -53,7 +53,9 @@ public:
 			_chi(2.0),
 			_gamma(0.5),
 			_sigma(0.5),
-			_function(function) {
+			_function(function),
+			_iter(0),
+			_f_calls(0) {
 		static_assert(N > 0, "N > 0");
 	}
 
@@ -105,17 +107,17 @@ public:
 	bool solve(const float_t tol_rel = 100*std::numeric_limits<float_t>::epsilon(),
 			const float_t tol_abs = std::numeric_limits<float_t>::epsilon(),
 			const std::size_t max_iter = 10000) {
-		std::size_t iter = 0;
-		std::size_t f_calls = N+1;
+		_iter = 0;
+		_f_calls = N+1;
 
 		bool converged = false;
-		while((! converged) && iter < max_iter) {
+		while((! converged) && _iter < max_iter) {
 			const sarray<float_t, N> x_bar = centroid();
 
 			// reflection
 			const smt::sarray<float_t, N> x_r = (float_t(1)+_rho)*x_bar-_rho*_x(_idx(N));
 			const float_t fval_r = _function(x_r);
-			f_calls += 1;
+			_f_calls += 1;
 
 			if(_fval(_idx(0)) <= fval_r && fval_r < _fval(_idx(N-1))) {
 				_x(_idx(N)) = x_r;
@@ -125,7 +127,7 @@ public:
 				// expansion
 				const smt::sarray<float_t, N> x_e = (float_t(1)+_rho*_chi)*x_bar-_rho*_chi*_x(_idx(N));
 				const float_t fval_e = _function(x_e);
-				f_calls += 1;
+				_f_calls += 1;
 
 				if(fval_e < fval_r) {
 					_x(_idx(N)) = x_e;
@@ -141,7 +143,7 @@ public:
 					// outside contraction
 					const smt::sarray<float_t, N> x_c = (float_t(1)+_rho*_gamma)*x_bar-_rho*_gamma*_x(_idx(N));
 					const float_t fval_c = _function(x_c);
-					f_calls += 1;
+					_f_calls += 1;
 
 					if(fval_c <= fval_r) {
 						_x(_idx(N)) = x_c;
@@ -155,14 +157,14 @@ public:
 							const smt::sarray<float_t, N> xnew = _x(_idx(ii));
 							_fval(_idx(ii)) = _function(_x(_idx(ii)));
 						}
-						f_calls += N;
+						_f_calls += N;
 						sort();
 					}
 				} else { // fval_r >= _fval(_idx(N))
 					// inside contraction
 					const smt::sarray<float_t, N> x_c = (float_t(1)-_gamma)*x_bar+_gamma*_x(_idx(N));
 					const float_t fval_c = _function(x_c);
-					f_calls += 1;
+					_f_calls += 1;
 
 					if(fval_c < _fval(_idx(N))) {
 						_x(_idx(N)) = x_c;
@@ -176,7 +178,7 @@ public:
 							const smt::sarray<float_t, N> xnew = _x(_idx(ii));
 							_fval(_idx(ii)) = _function(_x(_idx(ii)));
 						}
-						f_calls += N;
+						_f_calls += N;
 						sort();
 					}
 				}
@@ -188,7 +190,7 @@ public:
 					&& smt::normInf(dx) <= std::max(tol_abs, tol_rel*smt::normInf(_x(N)))) {
 				converged = true;
 			}
-			++iter;
+			++_iter;
 		}
 
 		return converged;
@@ -198,6 +200,14 @@ public:
 		return _x(_idx(0));
 	}
 
+	std::size_t iter() const {
+		return _iter;
+	}
+
+	std::size_t f_calls() const {
+		return _f_calls;
+	}
+
 	float_t fval() const {
 		return _fval(_idx(0));
 	}
@@ -212,6 +222,8 @@ private:
 	smt::sarray<smt::sarray<float_t, N>, N+1> _x;
 	smt::sarray<float_t, N+1> _fval;
 	smt::sarray<std::size_t, N+1> _idx;
+	std::size_t _iter;
+	std::size_t _f_calls;
 
 	smt::sarray<float_t, N> centroid() const {
 		smt::sarray<float_t, N> xbar = 0;
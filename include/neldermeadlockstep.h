@@ -0,0 +1,358 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _NELDERMEADLOCKSTEP_H
+#define _NELDERMEADLOCKSTEP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include "debug.h"
+#include "sarray.h"
+
+namespace smt {
+
+//
+// Nelder-Mead simplex method for a stream of independent problems of equal
+// dimension, e.g. voxels, which are distributed over K lanes and advanced in
+// lockstep. Each lane follows the same sequence of reflection, expansion,
+// contraction and shrinkage steps as smt::sNelderMead, but the trial points of
+// all lanes are evaluated by a single call of the function object,
+//
+//   void operator()(const smt::sarray<smt::sarray<float_t, N>, K>& x,
+//                   smt::sarray<float_t, K>& fval) const,
+//
+// such that the cost function may be vectorised across lanes. Once a lane has
+// converged, the next problem is assigned to it, which keeps the lanes busy
+// until the stream is exhausted. Idle lanes are masked, i.e. they are evaluated
+// at the trial point of an active lane and the function values are ignored.
+//
+
+template <typename float_t, std::size_t N, std::size_t K, typename function_t>
+class sNelderMeadLockstep {
+public:
+	sNelderMeadLockstep(const function_t& function):
+			_rho(1.0),
+			_chi(2.0),
+			_gamma(0.5),
+			_sigma(0.5),
+			_function(function) {
+		static_assert(N > 0, "N > 0");
+		static_assert(K > 0, "K > 0");
+
+		for(std::size_t ll = 0; ll < K; ++ll) {
+			_active(ll) = false;
+			_converged(ll) = false;
+			_iter(ll) = 0;
+			_f_calls(ll) = 0;
+		}
+	}
+
+	// Starts a problem in the given lane with the initial simplex of
+	// smt::sNelderMead::init(x).
+	void init(const std::size_t& ll, const smt::sarray<float_t, N>& x) {
+		const float_t alpha0 = 1.0;
+		const float_t alpha1 = 0.05;
+
+		float_t xmin = std::numeric_limits<float_t>::max();
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			if(x(ii) != 0) {
+				xmin = std::min(xmin, std::abs(x(ii)));
+			}
+		}
+		smt::sarray<float_t, N> dx;
+		if(xmin == std::numeric_limits<float_t>::max()) {
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				dx(ii) = alpha0;
+			}
+		} else {
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				if(x(ii) == 0) {
+					dx(ii) = alpha1*xmin;
+				} else {
+					dx(ii) = alpha1*x(ii);
+				}
+			}
+		}
+		for(std::size_t ii = 0; ii < N+1; ++ii) {
+			_x(ll)(ii) = x;
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			_x(ll)(ii+1)(ii) += dx(ii);
+		}
+		for(std::size_t ii = 0; ii < N+1; ++ii) {
+			_idx(ll)(ii) = ii;
+		}
+		_active(ll) = true;
+		_converged(ll) = false;
+		_iter(ll) = 0;
+		_f_calls(ll) = N+1;
+		_step(ll) = step::initialisation;
+		_vertex(ll) = 0;
+		_xt(ll) = _x(ll)(0);
+	}
+
+	// Solves the problems of all lanes, where next(ll) is called whenever lane
+	// ll becomes idle, including once for each lane at the beginning. It may
+	// retrieve the results of the lane and start another problem by calling
+	// init(ll, x).
+	template <typename next_t>
+	void solve(next_t next,
+			const float_t tol_rel = 100*std::numeric_limits<float_t>::epsilon(),
+			const float_t tol_abs = std::numeric_limits<float_t>::epsilon(),
+			const std::size_t max_iter = 10000) {
+		for(std::size_t ll = 0; ll < K; ++ll) {
+			_active(ll) = false;
+			next(ll);
+		}
+
+		while(true) {
+			std::size_t ref = K;
+			for(std::size_t ll = 0; ll < K; ++ll) {
+				if(_active(ll)) {
+					ref = ll;
+					break;
+				}
+			}
+			if(ref == K) {
+				break;
+			}
+			for(std::size_t ll = 0; ll < K; ++ll) {
+				if(! _active(ll)) {
+					_xt(ll) = _xt(ref);
+				}
+			}
+			_function(_xt, _ft);
+
+			for(std::size_t ll = 0; ll < K; ++ll) {
+				if(_active(ll) && advance(ll, _ft(ll))) {
+					if(_step(ll) != step::initialisation) {
+						// end of iteration
+						const smt::sarray<float_t, N> dx = _x(ll)(0)-_x(ll)(N);
+						if(std::abs(_fval(ll)(_idx(ll)(0))-_fval(ll)(_idx(ll)(N))) <= std::max(tol_abs, tol_rel*std::abs(_fval(ll)(_idx(ll)(N))))
+								&& smt::normInf(dx) <= std::max(tol_abs, tol_rel*smt::normInf(_x(ll)(N)))) {
+							_converged(ll) = true;
+						}
+						++_iter(ll);
+					}
+					if(_converged(ll) || _iter(ll) >= max_iter) {
+						_active(ll) = false;
+						next(ll);
+					} else {
+						reflect(ll);
+					}
+				}
+			}
+		}
+	}
+
+	smt::sarray<float_t, N> operator()(const std::size_t& ll) const {
+		return _x(ll)(_idx(ll)(0));
+	}
+
+	bool converged(const std::size_t& ll) const {
+		return _converged(ll);
+	}
+
+	std::size_t iter(const std::size_t& ll) const {
+		return _iter(ll);
+	}
+
+	std::size_t f_calls(const std::size_t& ll) const {
+		return _f_calls(ll);
+	}
+
+	float_t fval(const std::size_t& ll) const {
+		return _fval(ll)(_idx(ll)(0));
+	}
+
+private:
+	enum class step {
+		initialisation,
+		reflection,
+		expansion,
+		outside_contraction,
+		inside_contraction,
+		shrinkage
+	};
+
+	const float_t _rho; // reflection coefficient
+	const float_t _chi; // expansion coefficient
+	const float_t _gamma; // contraction coefficient
+	const float_t _sigma; // shrinkage coefficient
+	const function_t& _function;
+
+	smt::sarray<smt::sarray<smt::sarray<float_t, N>, N+1>, K> _x;
+	smt::sarray<smt::sarray<float_t, N+1>, K> _fval;
+	smt::sarray<smt::sarray<std::size_t, N+1>, K> _idx;
+	smt::sarray<bool, K> _active;
+	smt::sarray<bool, K> _converged;
+	smt::sarray<std::size_t, K> _iter;
+	smt::sarray<std::size_t, K> _f_calls;
+
+	// pending step, vertex being evaluated, centroid, reflected point and trial
+	// point of each lane
+	smt::sarray<step, K> _step;
+	smt::sarray<std::size_t, K> _vertex;
+	smt::sarray<smt::sarray<float_t, N>, K> _xbar;
+	smt::sarray<smt::sarray<float_t, N>, K> _xr;
+	smt::sarray<float_t, K> _fr;
+	smt::sarray<smt::sarray<float_t, N>, K> _xt;
+	smt::sarray<float_t, K> _ft;
+
+	void reflect(const std::size_t& ll) {
+		_xbar(ll) = centroid(ll);
+		_xt(ll) = (float_t(1)+_rho)*_xbar(ll)-_rho*_x(ll)(_idx(ll)(N));
+		_step(ll) = step::reflection;
+	}
+
+	void replace(const std::size_t& ll, const smt::sarray<float_t, N>& x, const float_t& fval) {
+		_x(ll)(_idx(ll)(N)) = x;
+		_fval(ll)(_idx(ll)(N)) = fval;
+		sortN(ll);
+	}
+
+	void shrink(const std::size_t& ll) {
+		_vertex(ll) = 1;
+		const std::size_t ii = _idx(ll)(1);
+		_x(ll)(ii) = _x(ll)(_idx(ll)(0))+_sigma*(_x(ll)(ii)-_x(ll)(_idx(ll)(0)));
+		_xt(ll) = _x(ll)(ii);
+		_step(ll) = step::shrinkage;
+	}
+
+	// Processes the function value at the trial point, and returns true at the
+	// end of the initialisation or an iteration.
+	bool advance(const std::size_t& ll, const float_t& fval) {
+		switch(_step(ll)) {
+		case step::initialisation:
+			_fval(ll)(_vertex(ll)) = fval;
+			if(++_vertex(ll) < N+1) {
+				_xt(ll) = _x(ll)(_vertex(ll));
+				return false;
+			}
+			sort(ll);
+			return true;
+		case step::reflection:
+			_f_calls(ll) += 1;
+			_xr(ll) = _xt(ll);
+			_fr(ll) = fval;
+			if(_fval(ll)(_idx(ll)(0)) <= fval && fval < _fval(ll)(_idx(ll)(N-1))) {
+				replace(ll, _xr(ll), fval);
+				return true;
+			} else if(fval < _fval(ll)(_idx(ll)(0))) {
+				_xt(ll) = (float_t(1)+_rho*_chi)*_xbar(ll)-_rho*_chi*_x(ll)(_idx(ll)(N));
+				_step(ll) = step::expansion;
+			} else if(_fval(ll)(_idx(ll)(N-1)) <= fval && fval < _fval(ll)(_idx(ll)(N))) {
+				_xt(ll) = (float_t(1)+_rho*_gamma)*_xbar(ll)-_rho*_gamma*_x(ll)(_idx(ll)(N));
+				_step(ll) = step::outside_contraction;
+			} else {
+				_xt(ll) = (float_t(1)-_gamma)*_xbar(ll)+_gamma*_x(ll)(_idx(ll)(N));
+				_step(ll) = step::inside_contraction;
+			}
+			return false;
+		case step::expansion:
+			_f_calls(ll) += 1;
+			if(fval < _fr(ll)) {
+				replace(ll, _xt(ll), fval);
+			} else {
+				replace(ll, _xr(ll), _fr(ll));
+			}
+			return true;
+		case step::outside_contraction:
+			_f_calls(ll) += 1;
+			if(fval <= _fr(ll)) {
+				replace(ll, _xt(ll), fval);
+				return true;
+			}
+			shrink(ll);
+			return false;
+		case step::inside_contraction:
+			_f_calls(ll) += 1;
+			if(fval < _fval(ll)(_idx(ll)(N))) {
+				replace(ll, _xt(ll), fval);
+				return true;
+			}
+			shrink(ll);
+			return false;
+		case step::shrinkage:
+			_fval(ll)(_idx(ll)(_vertex(ll))) = fval;
+			if(++_vertex(ll) < N+1) {
+				const std::size_t ii = _idx(ll)(_vertex(ll));
+				_x(ll)(ii) = _x(ll)(_idx(ll)(0))+_sigma*(_x(ll)(ii)-_x(ll)(_idx(ll)(0)));
+				_xt(ll) = _x(ll)(ii);
+				return false;
+			}
+			_f_calls(ll) += N;
+			sort(ll);
+			return true;
+		}
+
+		return true; // unreachable
+	}
+
+	smt::sarray<float_t, N> centroid(const std::size_t& ll) const {
+		smt::sarray<float_t, N> xbar = 0;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			xbar += _x(ll)(_idx(ll)(ii));
+		}
+		xbar /= N;
+
+		return xbar;
+	}
+
+	// Insertion sort, which orders ties as std::stable_sort in
+	// smt::sNelderMead does for short sequences, but avoids its temporary
+	// buffer.
+	void sort(const std::size_t& ll) {
+		for(std::size_t ii = 1; ii < N+1; ++ii) {
+			const std::size_t idx_tmp = _idx(ll)(ii);
+			const float_t fval_tmp = _fval(ll)(idx_tmp);
+			std::size_t jj = ii;
+			while(jj > 0 && fval_tmp <= _fval(ll)(_idx(ll)(jj-1))) {
+				_idx(ll)(jj) = _idx(ll)(jj-1);
+				--jj;
+			}
+			_idx(ll)(jj) = idx_tmp;
+		}
+	}
+
+	void sortN(const std::size_t& ll) {
+		const float_t fval_tmp = _fval(ll)(_idx(ll)(N));
+		const std::size_t idx_tmp = _idx(ll)(N);
+		std::size_t ii = N;
+		while(ii > 0 && fval_tmp < _fval(ll)(_idx(ll)(ii-1))) {
+			_idx(ll)(ii) = _idx(ll)(ii-1);
+			--ii;
+		}
+		_idx(ll)(ii) = idx_tmp;
+	}
+};
+
+} // smt
+
+#endif // _NELDERMEADLOCKSTEP_H
@@ -28,28 +28,39 @@
 #define _NIFTI_H
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cmath>
 #include <complex>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <functional>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 #ifdef ZLIB_FOUND
 #include <zlib.h>
 #endif // ZLIB_FOUND
 
 #include "nifti1.h"
 
+#include "cartesianrange.h"
 #include "darray.h"
 #include "debug.h"
+#ifdef ZLIB_FOUND
+#include "gzindex.h"
+#endif // ZLIB_FOUND
+#include "parfor.h"
 #include "sarray.h"
 
 namespace smt {
@@ -401,6 +412,16 @@ DEFINE_NIFTI_READFUN_COMPLEX_SCALED(std::complex<long double>, std::complex<long
 #undef DEFINE_NIFTI_READFUN_COMPLEX_SCALED
 #endif // DEFINE_NIFTI_READFUN_COMPLEX_SCALED
 
+// Bulk variant of nifti_readfun, which decodes n elements at a distance of
+// stride in one call such that the conversion is inlined into the loop.
+
+template <typename input_t, typename output_t, bool scaling>
+void nifti_gatherfun(const std::size_t& ii, const std::ptrdiff_t& stride, const std::size_t& n, const unsigned char* data, const float& slope, const float& offset, output_t* out) {
+	for(std::size_t kk = 0, jj = ii; kk < n; ++kk, jj += stride) {
+		out[kk] = nifti_readfun<input_t, output_t, scaling>(jj, data, slope, offset);
+	}
+}
+
 int fileno(std::FILE* f) {
 	if(f == nullptr) {
 		return -1;
@@ -442,41 +463,217 @@ std::size_t gzfread(void* buffer, std::size_t size, std::size_t count, gzFile st
 	return jj/size;
 }
 
-std::size_t gzfwrite(void const* buffer, std::size_t size, std::size_t count, gzFile stream) {
-	if(size == 0) {
-		return 0;
+std::size_t gzfskip(gzFile stream, std::size_t offset) {
+	smt::darray<unsigned char, 1> buffer(offset);
+	return smt::gzfread(buffer.begin(), 1, offset, stream);
+}
+
+// Member of a blocked gzip file (BGZF), whose header records the size of the
+// member in a 'BC' extra subfield, as written by bgzip and smt::onifti.
+
+struct gzmember {
+	std::size_t deflate_offset;
+	std::size_t deflate_size;
+	std::size_t offset;
+	std::size_t size;
+	std::uint32_t crc;
+};
+
+bool gzmembers(const unsigned char* buffer, const std::size_t& size, std::vector<gzmember>& members) {
+	members.clear();
+	std::size_t pos = 0;
+	std::size_t offset = 0;
+	while(pos < size) {
+		if(size-pos < 18 || buffer[pos] != 0x1f || buffer[pos+1] != 0x8b || buffer[pos+2] != 8 || (buffer[pos+3] & 4) == 0) {
+			return false;
+		}
+		const std::size_t xlen = buffer[pos+10] | (std::size_t(buffer[pos+11]) << 8);
+		std::size_t bsize = 0;
+		for(std::size_t ii = pos+12; ii+4 <= pos+12+xlen && ii+4 <= size; ) {
+			const std::size_t slen = buffer[ii+2] | (std::size_t(buffer[ii+3]) << 8);
+			if(buffer[ii] == 'B' && buffer[ii+1] == 'C' && slen == 2 && ii+6 <= size) {
+				bsize = (buffer[ii+4] | (std::size_t(buffer[ii+5]) << 8))+1;
+			}
+			ii += 4+slen;
+		}
+		std::size_t start = pos+12+xlen;
+		if((buffer[pos+3] & 8) != 0) {
+			while(start < size && buffer[start] != 0) {
+				++start;
+			}
+			++start;
+		}
+		if((buffer[pos+3] & 16) != 0) {
+			while(start < size && buffer[start] != 0) {
+				++start;
+			}
+			++start;
+		}
+		if((buffer[pos+3] & 2) != 0) {
+			start += 2;
+		}
+		if(bsize == 0 || size-pos < bsize || start+8 > pos+bsize) {
+			return false;
+		}
+
+		const unsigned char* trailer = buffer+pos+bsize-8;
+		gzmember m;
+		m.deflate_offset = start;
+		m.deflate_size = pos+bsize-8-start;
+		m.offset = offset;
+		m.size = trailer[4] | (std::size_t(trailer[5]) << 8) | (std::size_t(trailer[6]) << 16) | (std::size_t(trailer[7]) << 24);
+		m.crc = trailer[0] | (std::uint32_t(trailer[1]) << 8) | (std::uint32_t(trailer[2]) << 16) | (std::uint32_t(trailer[3]) << 24);
+		members.push_back(m);
+
+		offset += m.size;
+		pos += bsize;
 	}
-	if(count == 0) {
-		return 0;
+
+	return ! members.empty();
+}
+
+bool gzinflate(const unsigned char* buffer, const gzmember& m, unsigned char* out) {
+	z_stream strm;
+	std::memset(&strm, 0, sizeof(z_stream));
+	if(inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+		return false;
 	}
-	if(std::numeric_limits<std::size_t>::max()/size < count) {
-		return 0;
+	strm.next_in = const_cast<unsigned char*>(buffer+m.deflate_offset);
+	strm.avail_in = m.deflate_size;
+	strm.next_out = out;
+	strm.avail_out = m.size;
+	const int ret = inflate(&strm, Z_FINISH);
+	const bool valid = ret == Z_STREAM_END && strm.total_out == m.size && crc32(crc32(0L, Z_NULL, 0), out, m.size) == m.crc;
+	inflateEnd(&strm);
+
+	return valid;
+}
+
+// Parallel decompression of the bytes [offset, offset+size) of a blocked gzip
+// file, whose members are inflated independently by the threads of
+// smt::parfor. It returns false if the file is not blocked or is corrupt, in
+// which case the caller falls back to smt::gzfread. Members of up to 64 KiB
+// (BGZF) keep the per-thread buffers small.
+
+bool gzparread(const std::string& filename, const std::size_t& offset, unsigned char* data, const std::size_t& size) {
+	std::FILE* fin = (filename == "-")? nullptr : std::fopen(filename.c_str(), "rb");
+	if(fin == nullptr) {
+		return false;
 	}
-	std::size_t ii = size*count;
-	std::size_t jj = 0;
-	while(ii > std::numeric_limits<int>::max()) {
-		const int kk = gzwrite(stream, buffer, std::numeric_limits<int>::max());
-		jj += kk;
-		if(kk != std::numeric_limits<int>::max()) {
-			return jj/size;
-		}
-		buffer = reinterpret_cast<unsigned char const*>(buffer)+kk;
-		ii -= kk;
+	struct stat st;
+	unsigned char* buffer = (fstat(smt::fileno(fin), &st) == 0 && st.st_size > 0)?
+			static_cast<unsigned char*>(mmap(0, st.st_size, PROT_READ, MAP_SHARED, smt::fileno(fin), 0)) : static_cast<unsigned char*>(MAP_FAILED);
+	std::fclose(fin);
+	if(buffer == MAP_FAILED) {
+		return false;
 	}
-	const int kk = gzwrite(stream, buffer, ii);
-	jj += kk;
-	// if(kk != ii) {
-	// 	return jj/size;
-	// }
-	// buffer = reinterpret_cast<unsigned char const*>(buffer)+kk;
-	// ii -= kk;
 
-	return jj/size;
+	std::vector<gzmember> members;
+	bool valid = gzmembers(buffer, st.st_size, members) && members.back().offset+members.back().size >= offset+size;
+	if(valid) {
+		std::atomic<bool> failed{false};
+		smt::parfor(smt::cartesianrange<1>(members.size()), [&](const std::size_t ii, const unsigned int = 0) {
+			const gzmember& m = members[ii];
+			if(m.offset+m.size <= offset || m.offset >= offset+size || failed.load(std::memory_order_relaxed)) {
+				return;
+			}
+			if(offset <= m.offset && m.offset+m.size <= offset+size) {
+				if(! gzinflate(buffer, m, data+(m.offset-offset))) {
+					failed = true;
+				}
+			} else {
+				std::vector<unsigned char> tmp(m.size);
+				if(gzinflate(buffer, m, tmp.data())) {
+					const std::size_t first = std::max(offset, m.offset);
+					const std::size_t last = std::min(offset+size, m.offset+m.size);
+					std::copy(tmp.begin()+(first-m.offset), tmp.begin()+(last-m.offset), data+(first-offset));
+				} else {
+					failed = true;
+				}
+			}
+		}, smt::threads(), 16);
+		valid = ! failed;
+	}
+
+	munmap(buffer, st.st_size);
+
+	return valid;
 }
 
-std::size_t gzfskip(gzFile stream, std::size_t offset) {
-	smt::darray<unsigned char, 1> buffer(offset);
-	return smt::gzfread(buffer.begin(), 1, offset, stream);
+// Deflates a block of up to 65280 bytes into a gzip member with a 'BC' extra
+// subfield, such that the member does not exceed 64 KiB (BGZF).
+
+bool gzdeflate(const unsigned char* in, const std::size_t& size, std::vector<unsigned char>& out) {
+	out.resize(18+compressBound(size)+8);
+	z_stream strm;
+	std::memset(&strm, 0, sizeof(z_stream));
+	if(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return false;
+	}
+	strm.next_in = const_cast<unsigned char*>(in);
+	strm.avail_in = size;
+	strm.next_out = out.data()+18;
+	strm.avail_out = out.size()-18-8;
+	const int ret = deflate(&strm, Z_FINISH);
+	const std::size_t bsize = 18+strm.total_out+8;
+	deflateEnd(&strm);
+	if(ret != Z_STREAM_END || bsize > 65536) {
+		return false;
+	}
+
+	const unsigned char header[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, static_cast<unsigned char>((bsize-1) & 0xff), static_cast<unsigned char>((bsize-1) >> 8)};
+	std::copy(std::begin(header), std::end(header), out.begin());
+	const std::uint32_t crc = crc32(crc32(0L, Z_NULL, 0), in, size);
+	for(std::size_t ii = 0; ii < 4; ++ii) {
+		out[bsize-8+ii] = (crc >> (8*ii)) & 0xff;
+		out[bsize-4+ii] = (size >> (8*ii)) & 0xff;
+	}
+	out.resize(bsize);
+
+	return true;
+}
+
+// Parallel compression of a sequence of buffers into a blocked gzip file
+// (BGZF), i.e. a multi-member gzip stream that any gzip decoder reads and
+// smt::gzparread inflates in parallel. The buffers are split into blocks
+// which are deflated independently by the threads of smt::parfor, and
+// written in batches to bound the memory of the compressed blocks. The file
+// ends with the empty member that marks the end of a BGZF file.
+
+bool gzparwrite(const std::string& filename, const std::vector<std::pair<const unsigned char*, std::size_t>>& buffers, const unsigned int& nthreads) {
+	const std::size_t block = 65280;
+
+	std::vector<std::pair<const unsigned char*, std::size_t>> blocks;
+	for(const std::pair<const unsigned char*, std::size_t>& b : buffers) {
+		for(std::size_t ii = 0; ii < b.second; ii += block) {
+			blocks.push_back(std::make_pair(b.first+ii, std::min(block, b.second-ii)));
+		}
+	}
+	blocks.push_back(std::make_pair(static_cast<const unsigned char*>(nullptr), std::size_t(0)));
+
+	std::FILE* fout = std::fopen(filename.c_str(), "wb");
+	if(fout == nullptr) {
+		return false;
+	}
+
+	const std::size_t batch = 16*std::max(1u, nthreads);
+	std::vector<std::vector<unsigned char>> members(std::min(batch, blocks.size()));
+	bool valid = true;
+	for(std::size_t first = 0; valid && first < blocks.size(); first += batch) {
+		const std::size_t n = std::min(batch, blocks.size()-first);
+		std::atomic<bool> failed{false};
+		smt::parfor(smt::cartesianrange<1>(n), [&](const std::size_t ii, const unsigned int = 0) {
+			if(! gzdeflate(blocks[first+ii].first, blocks[first+ii].second, members[ii])) {
+				failed = true;
+			}
+		}, nthreads, 1);
+		valid = ! failed;
+		for(std::size_t ii = 0; valid && ii < n; ++ii) {
+			valid = std::fwrite(members[ii].data(), 1, members[ii].size(), fout) == members[ii].size();
+		}
+	}
+
+	return std::fclose(fout) == 0 && valid;
 }
 #endif // ZLIB_FOUND
 
@@ -599,12 +796,21 @@ public:
 		_header(),
 		_data(nullptr),
 		_mmapped(false),
-		_readfun() {
+		_readfun(nullptr),
+		_gatherfun(nullptr) {
 	}
 
 	inifti(const std::string& filename): inifti(smt::niftiname(filename)) {
 	}
 
+	// Reads the slices [first, first+count) along the third image axis only,
+	// e.g. for slab-wise processing, which yields an image of count slices in
+	// the spatial coordinates of the slab. A compressed image is decompressed
+	// by means of a random-access index (see gzindex.h), which is built on
+	// first use and persisted next to the image.
+	inifti(const std::string& filename, const std::size_t& first, const std::size_t& count): inifti(smt::niftiname(filename), true, first, count) {
+	}
+
 	inifti(const inifti&) = delete;
 
 	inifti(inifti&& rhs):
@@ -623,6 +829,7 @@ public:
 		rhs._data = nullptr;
 		_mmapped = std::move(rhs._mmapped);
 		_readfun = std::move(rhs._readfun);
+		_gatherfun = std::move(rhs._gatherfun);
 	}
 
 	inifti& operator=(const inifti&) = delete;
@@ -652,15 +859,21 @@ public:
 
 	smt::darray<T, 1> operator()(const std::size_t& i0, const std::size_t& i1, const std::size_t& i2, const smt::slice& slice) const {
 		static_assert(D == 4, "D == 4");
+		smt::assert(0 <= i0 && i0 < size(0) && 0 <= i1 && i1 < size(1) && 0 <= i2 && i2 < size(2));
 		smt::darray<T, 1> ret(slice.size());
-		std::size_t i3 = slice.start();
-		for(std::size_t ii = 0; ii < ret.size(); ++ii) {
-			ret(ii) = operator()(i0, i1, i2, i3);
-			i3 += slice.stride();
-		}
+		const std::size_t volsize = size(0)*size(1)*size(2);
+		read(i0+size(0)*(i1+size(1)*(i2+size(2)*slice.start())), slice.size(), ret.begin(), slice.stride()*std::ptrdiff_t(volsize));
 		return ret;
 	}
 
+	// Decodes count elements starting at the linear index first, e.g. a
+	// voxel vector (stride: number of voxels per volume), a slab or a volume
+	// (stride: 1).
+	void read(const std::size_t& first, const std::size_t& count, T* out, const std::ptrdiff_t& stride = 1) const {
+		smt::assert(count == 0 || (first < size() && std::ptrdiff_t(first)+std::ptrdiff_t(count-1)*stride >= 0 && std::ptrdiff_t(first)+std::ptrdiff_t(count-1)*stride < std::ptrdiff_t(size())));
+		_gatherfun(first, stride, count, _data, _header.scl_slope, _header.scl_inter, out);
+	}
+
 	std::size_t size() const {
 		std::size_t total_size = 1;
 		for(std::size_t ii = 0; ii < D; ++ii) {
@@ -744,9 +957,10 @@ private:
 	nifti_1_header _header;
 	unsigned char* _data;
 	bool _mmapped;
-	std::function<T(const std::size_t&, const unsigned char*, const float&, const float&)> _readfun;
+	T (*_readfun)(const std::size_t&, const unsigned char*, const float&, const float&);
+	void (*_gatherfun)(const std::size_t&, const std::ptrdiff_t&, const std::size_t&, const unsigned char*, const float&, const float&, T*);
 
-	inifti(const std::tuple<bool, bool, std::string, std::string>& niftiname):
+	inifti(const std::tuple<bool, bool, std::string, std::string>& niftiname, const bool& slab = false, const std::size_t& first = 0, const std::size_t& count = 0):
 			_gzipped(std::get<0>(niftiname)),
 			_separate_storage(std::get<1>(niftiname)),
 			_hdrname(std::get<2>(niftiname)),
@@ -798,7 +1012,9 @@ private:
 			std::exit(EXIT_FAILURE);
 		}
 
-		if(_gzipped) {
+		if(slab) {
+			read_slab(first, count);
+		} else if(_gzipped) {
 			if(_separate_storage) {
 #ifdef ZLIB_FOUND
 				if(gzclose(_zin) != 0) {
@@ -809,18 +1025,19 @@ private:
 					smt::error("Unable to open ‘" + _imgname + "’.");
 					std::exit(EXIT_FAILURE);
 				}
-				if(smt::gzfskip(_zin, std::max(0L, offset())) != std::max(0L, offset())) {
-					smt::error("Unable to read ‘" + _imgname + "’.");
-					std::exit(EXIT_FAILURE);
-				}
-
 				if((_data = new unsigned char[bytesize()*size()]) == nullptr) {
 					smt::error("Unable to allocate memory.");
 					std::exit(EXIT_FAILURE);
 				}
-				if(smt::gzfread(_data, bytesize(), size(), _zin) != size()) {
-					smt::error("Unable to read ‘" + _imgname + "’.");
-					std::exit(EXIT_FAILURE);
+				if(! smt::gzparread(_imgname, std::max(0L, offset()), _data, bytesize()*size())) {
+					if(smt::gzfskip(_zin, std::max(0L, offset())) != std::max(0L, offset())) {
+						smt::error("Unable to read ‘" + _imgname + "’.");
+						std::exit(EXIT_FAILURE);
+					}
+					if(smt::gzfread(_data, bytesize(), size(), _zin) != size()) {
+						smt::error("Unable to read ‘" + _imgname + "’.");
+						std::exit(EXIT_FAILURE);
+					}
 				}
 				_mmapped = false;
 #else
@@ -829,18 +1046,19 @@ private:
 #endif // ZLIB_FOUND
 			} else {
 #ifdef ZLIB_FOUND
-				if(smt::gzfskip(_zin, std::max(352L, offset())-352L+4L) != std::max(352L, offset())-352L+4L) {
-					smt::error("Unable to read ‘" + _imgname + "’.");
-					std::exit(EXIT_FAILURE);
-				}
-
 				if((_data = new unsigned char[bytesize()*size()]) == nullptr) {
 					smt::error("Unable to allocate memory.");
 					std::exit(EXIT_FAILURE);
 				}
-				if(smt::gzfread(_data, bytesize(), size(), _zin) != size()) {
-					smt::error("Unable to read ‘" + _imgname + "’.");
-					std::exit(EXIT_FAILURE);
+				if(! smt::gzparread(_imgname, std::max(352L, offset()), _data, bytesize()*size())) {
+					if(smt::gzfskip(_zin, std::max(352L, offset())-352L+4L) != std::max(352L, offset())-352L+4L) {
+						smt::error("Unable to read ‘" + _imgname + "’.");
+						std::exit(EXIT_FAILURE);
+					}
+					if(smt::gzfread(_data, bytesize(), size(), _zin) != size()) {
+						smt::error("Unable to read ‘" + _imgname + "’.");
+						std::exit(EXIT_FAILURE);
+					}
 				}
 				_mmapped = false;
 #else
@@ -965,8 +1183,10 @@ private:
 #define DEFINE_NIFTI_READFUN(OUTPUT_T) \
 		if(_header.scl_slope == 0.0f || (_header.scl_slope == 1.0f && _header.scl_inter == 0.0f)) { \
 			_readfun = &nifti_readfun<OUTPUT_T, T, false>; \
+			_gatherfun = &nifti_gatherfun<OUTPUT_T, T, false>; \
 		} else { \
 			_readfun = &nifti_readfun<OUTPUT_T, T, true>; \
+			_gatherfun = &nifti_gatherfun<OUTPUT_T, T, true>; \
 		}
 
 		switch(_header.datatype) {
@@ -1022,6 +1242,94 @@ private:
 #endif // DEFINE_NIFTI_READFUN
 	}
 
+	void read_slab(const std::size_t& first, const std::size_t& count) {
+		if(D < 3 || count == 0 || first+count > size(2)) {
+			smt::error("Slab exceeds ‘" + _hdrname + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+
+		const std::size_t slice = bytesize()*size(0)*size(1);
+		const std::size_t volume = slice*size(2);
+		const std::size_t nvolumes = size()/(size(0)*size(1)*size(2));
+		const std::uint64_t start = (_separate_storage)? std::max(0L, offset()) : std::max(352L, offset());
+
+		std::FILE* fin = std::fopen(_imgname.c_str(), "rb");
+		if(fin == nullptr) {
+			smt::error("Unable to open ‘" + _imgname + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+#ifdef ZLIB_FOUND
+		smt::gzindex index;
+		const bool loaded = _gzipped && index.load(_imgname + ".gzidx", _imgname);
+		if(_gzipped && ! loaded) {
+			if(! index.build(_imgname)) {
+				smt::error("Unable to read ‘" + _imgname + "’.");
+				std::exit(EXIT_FAILURE);
+			}
+			// A read-only directory merely prevents the reuse of the index.
+			index.save(_imgname + ".gzidx");
+		}
+#else
+		if(_gzipped) {
+			smt::error("Built without support for gzip format.");
+			std::exit(EXIT_FAILURE);
+		}
+#endif // ZLIB_FOUND
+
+		set_slab(first, count);
+		if((_data = new unsigned char[bytesize()*size()]) == nullptr) {
+			smt::error("Unable to allocate memory.");
+			std::exit(EXIT_FAILURE);
+		}
+		_mmapped = false;
+#ifdef ZLIB_FOUND
+		if(_gzipped) {
+			std::vector<smt::gzindex::range> ranges;
+			for(std::size_t ii = 0; ii < nvolumes; ++ii) {
+				ranges.push_back(smt::gzindex::range{start+ii*volume+first*slice, count*slice, _data+ii*count*slice});
+			}
+			if(! index.read(fin, ranges)) {
+				// A sidecar which is damaged despite a valid header is
+				// rebuilt once.
+				if(! loaded || ! index.build(_imgname) || ! index.read(fin, ranges)) {
+					smt::error("Unable to read ‘" + _imgname + "’.");
+					std::exit(EXIT_FAILURE);
+				}
+				index.save(_imgname + ".gzidx");
+			}
+		}
+#endif // ZLIB_FOUND
+		for(std::size_t ii = 0; ii < nvolumes && ! _gzipped; ++ii) {
+			if(fseeko(fin, start+ii*volume+first*slice, SEEK_SET) != 0 || std::fread(_data+ii*count*slice, 1, count*slice, fin) != count*slice) {
+				smt::error("Unable to read ‘" + _imgname + "’.");
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		if(std::fclose(fin) != 0) {
+			smt::error("Unable to close ‘" + _imgname + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	// Restricts the header to the slices [first, first+count), where the
+	// origin of the qform and sform moves to the first slice.
+	void set_slab(const std::size_t& first, const std::size_t& count) {
+		_header.dim[3] = count;
+
+		const double b = _header.quatern_b;
+		const double c = _header.quatern_c;
+		const double d = _header.quatern_d;
+		const double a = std::sqrt(std::max(0.0, 1.0-b*b-c*c-d*d));
+		const double dz = ((_header.pixdim[0] < 0.0f)? -1.0 : 1.0)*_header.pixdim[3]*first;
+		_header.qoffset_x += 2.0*(b*d+a*c)*dz;
+		_header.qoffset_y += 2.0*(c*d-a*b)*dz;
+		_header.qoffset_z += (a*a+d*d-b*b-c*c)*dz;
+
+		_header.srow_x[3] += _header.srow_x[2]*first;
+		_header.srow_y[3] += _header.srow_y[2]*first;
+		_header.srow_z[3] += _header.srow_z[2]*first;
+	}
+
 	std::size_t bytesize() const {
 		return nifti_bytesize(_header.datatype);
 	}
@@ -1066,7 +1374,8 @@ public:
 		_extender(),
 		_fout(nullptr),
 		_data(),
-		_mmapped(false) {
+		_mmapped(false),
+		_closed(false) {
 	}
 
 	template <typename Tlike, unsigned int Dlike>
@@ -1089,7 +1398,7 @@ public:
 	}
 
 	explicit operator bool() const {
-		return _data != nullptr;
+		return static_cast<bool>(_data);
 	}
 
 	T& operator[](const std::size_t& ii) {
@@ -1127,70 +1436,34 @@ public:
 		_header.cal_max = max;
 	}
 
-	~onifti() {
-		if(_data) {
+	// Writes the image to disk, which is otherwise done on destruction. A
+	// compressed image is deflated by nthreads threads.
+	void close(const unsigned int& nthreads = smt::threads()) {
+		if(operator bool() && ! _closed) {
+			_closed = true;
 			if(_gzipped) {
 				if(_separate_storage) {
 #ifdef ZLIB_FOUND
-					gzFile zout = gzopen(_hdrname.c_str(), "wb");
-					if(zout == nullptr) {
-						smt::error("Unable to open ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-					if(smt::gzfwrite(reinterpret_cast<unsigned char*>(&_header), sizeof(_header), 1, zout) != 1) {
-						smt::error("Unable to write ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-					if(smt::gzfwrite(reinterpret_cast<unsigned char*>(&_extender), sizeof(_extender), 1, zout) != 1) {
+					const std::vector<unsigned char> h = head();
+					if(! smt::gzparwrite(_hdrname, {std::make_pair(h.data(), h.size())}, 1)) {
 						smt::error("Unable to write ‘" + _hdrname + "’.");
 						std::exit(EXIT_FAILURE);
 					}
-					if(gzclose(zout) != 0) {
-						smt::error("Unable to close ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-
-					zout = gzopen(_imgname.c_str(), "wb");
-					if(zout == nullptr) {
-						smt::error("Unable to open ‘" + _imgname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-					if(smt::gzfwrite(reinterpret_cast<unsigned char*>(_data.begin()), sizeof(T), _data.size(), zout) != _data.size()) {
+					if(! smt::gzparwrite(_imgname, {std::make_pair(reinterpret_cast<const unsigned char*>(_data.begin()), sizeof(T)*_data.size())}, nthreads)) {
 						smt::error("Unable to write ‘" + _imgname + "’.");
 						std::exit(EXIT_FAILURE);
 					}
-					if(gzclose(zout) != 0) {
-						smt::error("Unable to close ‘" + _imgname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
 #else
 					smt::error("Built without support for gzip format.");
 					std::exit(EXIT_FAILURE);
 #endif // ZLIB_FOUND
 				} else {
 #ifdef ZLIB_FOUND
-					gzFile zout = gzopen(_hdrname.c_str(), "wb");
-					if(zout == nullptr) {
-						smt::error("Unable to open ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-					if(smt::gzfwrite(reinterpret_cast<unsigned char*>(&_header), sizeof(_header), 1, zout) != 1) {
-						smt::error("Unable to write ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-					if(smt::gzfwrite(reinterpret_cast<unsigned char*>(&_extender), sizeof(_extender), 1, zout) != 1) {
+					const std::vector<unsigned char> h = head();
+					if(! smt::gzparwrite(_hdrname, {std::make_pair(h.data(), h.size()), std::make_pair(reinterpret_cast<const unsigned char*>(_data.begin()), sizeof(T)*_data.size())}, nthreads)) {
 						smt::error("Unable to write ‘" + _hdrname + "’.");
 						std::exit(EXIT_FAILURE);
 					}
-
-					if(smt::gzfwrite(reinterpret_cast<unsigned char*>(_data.begin()), sizeof(T), _data.size(), zout) != _data.size()) {
-						smt::error("Unable to write ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
-					if(gzclose(zout) != 0) {
-						smt::error("Unable to close ‘" + _hdrname + "’.");
-						std::exit(EXIT_FAILURE);
-					}
 #else
 				smt::error("Built without support for gzip format.");
 				std::exit(EXIT_FAILURE);
@@ -1269,6 +1542,10 @@ public:
 		}
 	}
 
+	~onifti() {
+		close();
+	}
+
 private:
 	const bool _gzipped;
 	const bool _separate_storage;
@@ -1279,6 +1556,15 @@ private:
 	nifti1_extender _extender;
 	smt::darray<T, D> _data;
 	bool _mmapped;
+	bool _closed;
+
+	std::vector<unsigned char> head() const {
+		std::vector<unsigned char> h(sizeof(_header)+sizeof(_extender));
+		std::memcpy(h.data(), &_header, sizeof(_header));
+		std::memcpy(h.data()+sizeof(_header), &_extender, sizeof(_extender));
+
+		return h;
+	}
 
 	template <typename Tlike, unsigned int Dlike>
 	onifti(const std::tuple<bool, bool, std::string, std::string>& niftiname,
@@ -1289,7 +1575,8 @@ private:
 			_gzipped(std::get<0>(niftiname)),
 			_separate_storage(std::get<1>(niftiname)),
 			_hdrname(std::get<2>(niftiname)),
-			_imgname(std::get<3>(niftiname)) {
+			_imgname(std::get<3>(niftiname)),
+			_closed(false) {
 		static_assert(D == 3, "D == 3");
 
 		_header = default_header(like._header);
@@ -1351,7 +1638,8 @@ private:
 			_gzipped(std::get<0>(niftiname)),
 			_separate_storage(std::get<1>(niftiname)),
 			_hdrname(std::get<2>(niftiname)),
-			_imgname(std::get<3>(niftiname)) {
+			_imgname(std::get<3>(niftiname)),
+			_closed(false) {
 		static_assert(D == 4, "D == 4");
 
 		_header = default_header(like._header);
@@ -1454,6 +1742,33 @@ private:
 	}
 };
 
+namespace {
+
+template <typename output_t>
+void parclose_impl(std::vector<std::thread>& threads, output_t& output, const unsigned int& nthreads) {
+	threads.emplace_back([&output, nthreads]() {
+		output.close(nthreads);
+	});
+}
+
+} // (anonymous)
+
+// Writes several images concurrently, e.g. the parameter maps of split
+// outputs, with the threads shared between them.
+
+template <typename... outputs_t>
+void parclose(outputs_t&... outputs) {
+	const bool open[] = {static_cast<bool>(outputs)...};
+	const unsigned int nthreads = std::max(1u, smt::threads()/std::max(1u, static_cast<unsigned int>(std::count(std::begin(open), std::end(open), true))));
+	std::vector<std::thread> threads;
+	threads.reserve(sizeof...(outputs));
+	const int expand[] = {0, (parclose_impl(threads, outputs, nthreads), 0)...};
+	static_cast<void>(expand);
+	for(std::thread& t : threads) {
+		t.join();
+	}
+}
+
 } // smt
 
 #endif // _NIFTI_H
@@ -38,6 +38,9 @@
 #include "neldermead.h"
 #include "pow.h"
 #include "sarray.h"
+#include "solver.h"
+#include "trustregion.h"
+#include "vmath.h"
 
 namespace smt {
 
@@ -49,11 +52,17 @@ public:
 	}
 
 	float_t operator()(const smt::sarray<float_t, 2>& x) const {
-		const float_t e0 = std::exp(x(0));
-		const float_t sigma = std::exp(x(1));
+		return value(trans(x));
+	}
+
+	// Negative log-likelihood in terms of the location and scale parameter,
+	// see lower() and upper().
+	float_t value(const smt::sarray<float_t, 2>& y) const {
+		const float_t e0 = y(0);
+		const float_t sigma = y(1);
 		float_t fval = 0;
 		for(std::size_t ii = 0; ii < _y.size(); ++ii) {
-			fval += (float_t(0) < _y(ii))? -std::log(_y(ii)/smt::pow2(sigma))+smt::pow2(_y(ii)-e0)/(2*smt::pow2(sigma))-std::log(smt::besselei0(_y(ii)*e0/smt::pow2(sigma))) : std::log(float_t(0));
+			fval += (float_t(0) < _y(ii))? -smt::vlog(_y(ii)/smt::pow2(sigma))+smt::pow2(_y(ii)-e0)/(2*smt::pow2(sigma))-smt::vlog(smt::besselei0(_y(ii)*e0/smt::pow2(sigma))) : std::log(float_t(0));
 		}
 
 		return fval;
@@ -67,10 +76,20 @@ public:
 		return x0;
 	}
 
+	smt::sarray<float_t, 2> lower() const {
+		const float_t eps = std::sqrt(std::numeric_limits<float_t>::epsilon());
+
+		return smt::sarray<float_t, 2>{eps*smax(), eps*smax()};
+	}
+
+	smt::sarray<float_t, 2> upper() const {
+		return smt::sarray<float_t, 2>{smax(), smax()};
+	}
+
 	smt::sarray<float_t, 2> trans(const smt::sarray<float_t, 2>& x) const {
 		smt::sarray<float_t, 2> y;
-		y(0) = std::exp(x(0));
-		y(1) = std::exp(x(1));
+		y(0) = smt::vexp(x(0));
+		y(1) = smt::vexp(x(1));
 
 		return y;
 	}
@@ -90,6 +109,15 @@ private:
 		return y;
 	}
 
+	float_t smax() const {
+		float_t y_max = std::numeric_limits<float_t>::min();
+		for(std::size_t ii = 0; ii < _y.size(); ++ii) {
+			y_max = std::max(y_max, _y(ii));
+		}
+
+		return float_t(2)*y_max;
+	}
+
 	float_t meansignal() const {
 		smt::assert(_y.size() > 0);
 
@@ -113,18 +141,31 @@ private:
 	}
 };
 
+// The Levenberg-Marquardt method is not applicable to the likelihood function,
+// which is minimised by the Nelder-Mead method otherwise.
+
 template <typename float_t>
 smt::sarray<float_t, 2> ricianfit(const smt::darray<float_t, 1>& y,
 		const float_t& minsignal = 0,
+		const smt::solver& method = smt::solver::neldermead,
 		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
 		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon()) {
 	RiceLikeFunction<float_t> f(y, minsignal);
-	smt::sNelderMead<float_t, 2, RiceLikeFunction<float_t>> solver(f);
-	solver.init(f.init());
-	solver.solve(opt_rel, opt_abs);
-	smt::sarray<float_t, 2> x = f.trans(solver());
-
-	return x;
+	if(method == smt::solver::trustregion) {
+		const smt::BoundedFunction<float_t, 2, RiceLikeFunction<float_t>> g(f);
+		smt::sTrustRegion<float_t, 2, smt::BoundedFunction<float_t, 2, RiceLikeFunction<float_t>>> solver(g);
+		solver.init(f.trans(f.init()), f.lower(), f.upper());
+		solver.solve(opt_rel, opt_abs);
+
+		return solver();
+	} else {
+		smt::sNelderMead<float_t, 2, RiceLikeFunction<float_t>> solver(f);
+		solver.init(f.init());
+		solver.solve(opt_rel, opt_abs);
+		smt::sarray<float_t, 2> x = f.trans(solver());
+
+		return x;
+	}
 }
 
 } // smt
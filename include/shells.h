@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _SHELLS_H
+#define _SHELLS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <numeric>
+
+#include "darray.h"
+#include "debug.h"
+#include "diffenc.h"
+#include "pow.h"
+
+namespace smt {
+
+//
+// The spherical mean signal depends on the diffusion weighting factor only.
+// Measurements with identical b-value are pooled into shells, such that the
+// sum of squares over all measurements decomposes into
+//
+//   sum_i (y_i-s(b_i))^2 = sum_k n_k (ybar_k-s(b_k))^2 + sum_k ss_k,
+//
+// where n_k, ybar_k and ss_k denote the number of measurements, the mean and
+// the sum of squared deviations from the mean in the kth shell. The last term
+// does not depend on the model, hence the cost function can be evaluated in
+// O(number of shells) without changing its value or minimiser.
+//
+
+template <typename float_t>
+class shells {
+public:
+	shells() {}
+
+	shells(const smt::darray<float_t, 1>& y, const smt::diffenc<float_t>& dw) {
+		smt::assert(y.size() == dw.mapping.size());
+
+		smt::darray<std::size_t, 1> idx(dw.mapping.size());
+		std::iota(std::begin(idx), std::end(idx), 0);
+		std::stable_sort(std::begin(idx), std::end(idx), [&](const std::size_t& ii, const std::size_t& jj) {
+			return dw.bvalues(dw.mapping(ii)) < dw.bvalues(dw.mapping(jj));
+		});
+
+		std::size_t n = 0;
+		for(std::size_t ii = 0; ii < idx.size(); ++ii) {
+			if(ii == 0 || dw.bvalues(dw.mapping(idx(ii))) != dw.bvalues(dw.mapping(idx(ii-1)))) {
+				++n;
+			}
+		}
+
+		_bvalues.resize(n);
+		_counts.resize(n);
+		_means.resize(n);
+		_sumsq.resize(n);
+
+		std::size_t kk = 0;
+		std::size_t ii = 0;
+		while(ii < idx.size()) {
+			const float_t bvalue = dw.bvalues(dw.mapping(idx(ii)));
+			std::size_t jj = ii;
+			float_t sum = 0;
+			while(jj < idx.size() && dw.bvalues(dw.mapping(idx(jj))) == bvalue) {
+				sum += y(idx(jj));
+				++jj;
+			}
+			const float_t mean = sum/(jj-ii);
+			float_t sumsq = 0;
+			for(std::size_t ll = ii; ll < jj; ++ll) {
+				sumsq += smt::pow2(y(idx(ll))-mean);
+			}
+			_bvalues(kk) = bvalue;
+			_counts(kk) = jj-ii;
+			_means(kk) = mean;
+			_sumsq(kk) = sumsq;
+			ii = jj;
+			++kk;
+		}
+	}
+
+	std::size_t size() const {
+		return _bvalues.size();
+	}
+
+	float_t bvalue(const std::size_t& ii) const {
+		return _bvalues(ii);
+	}
+
+	const smt::darray<float_t, 1>& bvalues() const {
+		return _bvalues;
+	}
+
+	std::size_t count(const std::size_t& ii) const {
+		return _counts(ii);
+	}
+
+	float_t mean(const std::size_t& ii) const {
+		return _means(ii);
+	}
+
+	float_t sumsq(const std::size_t& ii) const {
+		return _sumsq(ii);
+	}
+
+	~shells() {
+	}
+
+private:
+	smt::darray<float_t, 1> _bvalues;
+	smt::darray<std::size_t, 1> _counts;
+	smt::darray<float_t, 1> _means;
+	smt::darray<float_t, 1> _sumsq;
+};
+
+} // smt
+
+#endif // _SHELLS_H
@@ -0,0 +1,204 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _SOLVER_H
+#define _SOLVER_H
+
+#include <cstddef>
+#include <limits>
+#include <string>
+
+#include "brent.h"
+#include "debug.h"
+#include "levenbergmarquardt.h"
+#include "neldermead.h"
+#include "sarray.h"
+#include "trustregion.h"
+
+namespace smt {
+
+enum class solver {
+	neldermead,
+	levmar,
+	trustregion,
+	brent
+};
+
+bool parse_solver(const std::string& str, solver& method) {
+	if(str == "neldermead") {
+		method = solver::neldermead;
+	} else if(str == "levmar") {
+		method = solver::levmar;
+	} else if(str == "trustregion") {
+		method = solver::trustregion;
+	} else if(str == "brent") {
+		method = solver::brent;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+// Summary of a solver run, i.e. the number of iterations and cost function
+// evaluations, the convergence status and the final cost function value.
+
+template <typename float_t>
+struct optinfo {
+	std::size_t iter = 0;
+	std::size_t f_calls = 0;
+	bool converged = false;
+	float_t fval = 0;
+};
+
+// Cost function in terms of the model parameters rather than the unconstrained
+// variables, for solvers which handle simple bounds themselves.
+
+template <typename float_t, unsigned int N, typename function_t>
+class BoundedFunction {
+public:
+	BoundedFunction(const function_t& f): _f(f) {
+	}
+
+	float_t operator()(const smt::sarray<float_t, N>& y) const {
+		return _f.value(y);
+	}
+
+	~BoundedFunction() {
+	}
+
+private:
+	const function_t& _f;
+};
+
+// The Levenberg-Marquardt method requires the function object to provide the
+// residuals and their Jacobian, see levenbergmarquardt.h. The trust-region
+// method and nested univariate searches operate on the model parameters within
+// the bounds lower() and upper() via value(), and the function object maps
+// between both parametrisations via trans() and init().
+
+template <typename float_t, unsigned int N, typename function_t>
+smt::sarray<float_t, N> minimise(const function_t& f,
+		const smt::sarray<float_t, N>& x0,
+		optinfo<float_t>& info,
+		const solver& method = solver::neldermead,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	smt::assert(method != solver::brent);
+
+	if(method == solver::levmar) {
+		smt::sLevenbergMarquardt<float_t, N, function_t> ssolver(f);
+		ssolver.init(x0);
+		info.converged = ssolver.solve(opt_rel, opt_abs, max_iter);
+		info.iter = ssolver.iter();
+		info.f_calls = ssolver.f_calls();
+		info.fval = ssolver.fval();
+
+		return ssolver();
+	} else if(method == solver::trustregion) {
+		const BoundedFunction<float_t, N, function_t> g(f);
+		smt::sTrustRegion<float_t, N, BoundedFunction<float_t, N, function_t>> ssolver(g);
+		ssolver.init(f.trans(x0), f.lower(), f.upper());
+		info.converged = ssolver.solve(opt_rel, opt_abs, max_iter);
+		info.iter = ssolver.iter();
+		info.f_calls = ssolver.f_calls();
+		info.fval = ssolver.fval();
+
+		return f.init(ssolver());
+	} else {
+		smt::sNelderMead<float_t, N, function_t> ssolver(f);
+		ssolver.init(x0);
+		info.converged = ssolver.solve(opt_rel, opt_abs, max_iter);
+		info.iter = ssolver.iter();
+		info.f_calls = ssolver.f_calls();
+		info.fval = ssolver.fval();
+
+		return ssolver();
+	}
+}
+
+// Nested univariate searches are restricted to two parameters, see brent.h,
+// such that this overload takes precedence for two-parameter functions. Other
+// methods are delegated to the general case.
+
+template <typename float_t, typename function_t>
+smt::sarray<float_t, 2> minimise(const function_t& f,
+		const smt::sarray<float_t, 2>& x0,
+		optinfo<float_t>& info,
+		const solver& method = solver::neldermead,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	if(method == solver::brent) {
+		const BoundedFunction<float_t, 2, function_t> g(f);
+		smt::sProfileBrent<float_t, BoundedFunction<float_t, 2, function_t>> ssolver(g);
+		ssolver.init(f.trans(x0), f.lower(), f.upper());
+		info.converged = ssolver.solve(opt_rel, opt_abs, max_iter);
+		info.iter = ssolver.iter();
+		info.f_calls = ssolver.f_calls();
+		info.fval = ssolver.fval();
+
+		return f.init(ssolver());
+	}
+
+	return minimise<float_t, 2, function_t>(f, x0, info, method, opt_rel, opt_abs, max_iter);
+}
+
+template <typename float_t, unsigned int N, typename function_t>
+smt::sarray<float_t, N> minimise(const function_t& f,
+		const smt::sarray<float_t, N>& x0,
+		const solver& method = solver::neldermead,
+		const float_t& opt_rel = 1000*std::numeric_limits<float_t>::epsilon(),
+		const float_t& opt_abs = 10*std::numeric_limits<float_t>::epsilon(),
+		const std::size_t& max_iter = 10000) {
+	optinfo<float_t> info;
+
+	return minimise(f, x0, info, method, opt_rel, opt_abs, max_iter);
+}
+
+// Starting point derived from the given parameters if these are admissible and
+// improve on the cost function value of the default starting point, and the
+// default starting point otherwise. This allows warm starts from estimates
+// of, for example, a neighbouring voxel, which are discarded if they do not
+// fit the data at hand.
+
+template <typename float_t, unsigned int N, typename function_t>
+smt::sarray<float_t, N> start(const function_t& f, const smt::sarray<float_t, N>& x) {
+	const smt::sarray<float_t, N> x0 = f.init();
+	if(f.admissible(x)) {
+		const smt::sarray<float_t, N> x1 = f.init(x);
+		if(f(x1) < f(x0)) {
+			return x1;
+		}
+	}
+
+	return x0;
+}
+
+} // smt
+
+#endif // _SOLVER_H
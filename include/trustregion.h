@@ -0,0 +1,640 @@
+//
+// Copyright (c) 2016 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _TRUSTREGION_H
+#define _TRUSTREGION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include "debug.h"
+#include "pow.h"
+#include "project.h"
+#include "sarray.h"
+
+namespace smt {
+
+//
+// Powell MJD: The BOBYQA Algorithm for Bound Constrained Optimization without
+// Derivatives. Technical Report DAMTP 2009/NA06, University of Cambridge, 2009.
+//
+// Conn AR, Scheinberg K and Vicente LN: Introduction to Derivative-Free
+// Optimization. SIAM, 2009.
+//
+// The cost function is approximated by the quadratic polynomial interpolating
+// (N+1)(N+2)/2 points, which is minimised in the intersection of the feasible
+// box and an infinity-norm trust region. The trust-region subproblem is solved
+// exactly by enumerating the faces of this box, which is practical for a few
+// variables only. The variables are scaled to the unit box, and the function
+// object is never evaluated outside the bounds. The final trust-region radius
+// equals the square root of the tolerance, since the cost function is
+// quadratic near its minimum.
+//
+
+template <typename float_t, std::size_t N, typename function_t>
+class sTrustRegion {
+public:
+	sTrustRegion(const function_t& function):
+			_rho_beg(0.1),
+			_function(function),
+			_iter(0),
+			_f_calls(0) {
+		static_assert(N > 0, "N > 0");
+	}
+
+	void init(const smt::sarray<float_t, N>& x, const smt::sarray<float_t, N>& lower, const smt::sarray<float_t, N>& upper) {
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			smt::assert(lower(ii) < upper(ii));
+		}
+		_lower = lower;
+		_upper = upper;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			_y(0)(ii) = smt::project((x(ii)-_lower(ii))/(_upper(ii)-_lower(ii)), float_t(0), float_t(1));
+		}
+		_kopt = 0;
+		_f_calls = 0;
+		_fval(0) = evaluate(_y(0));
+	}
+
+	bool solve(const float_t tol_rel = 100*std::numeric_limits<float_t>::epsilon(),
+			const float_t tol_abs = std::numeric_limits<float_t>::epsilon(),
+			const std::size_t max_iter = 10000) {
+		_iter = 0;
+
+		const float_t rho_end = std::min(std::sqrt(std::max(tol_rel, tol_abs)), _rho_beg);
+		float_t rho = _rho_beg;
+		float_t delta = rho;
+		rebuild(rho);
+		smt::sarray<float_t, 3> err = std::numeric_limits<float_t>::max();
+
+		bool converged = false;
+		while((! converged) && _iter < max_iter) {
+			++_iter;
+
+			if(! model()) {
+				rebuild(rho);
+				continue;
+			}
+
+			// trust-region step
+			smt::sarray<float_t, N> lo;
+			smt::sarray<float_t, N> hi;
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				lo(ii) = std::max(-delta, -_y(_kopt)(ii));
+				hi(ii) = std::min(delta, float_t(1)-_y(_kopt)(ii));
+			}
+			const smt::sarray<float_t, N> s = minquad(_g, _H, lo, hi);
+			const float_t snorm = smt::normInf(s);
+
+			if(snorm < float_t(0.5)*rho) {
+				// The geometry of the interpolation points is not improved if
+				// the recent model errors are small relative to the curvature.
+				float_t curv = _H(0)(0);
+				for(std::size_t ii = 1; ii < N; ++ii) {
+					curv = std::min(curv, _H(ii)(ii));
+				}
+				const bool accurate = smt::normInf(err) <= float_t(0.125)*curv*rho*rho;
+				const std::size_t kk = farthest();
+				if((! accurate) && dist(_y(kk), _y(_kopt)) > float_t(2)*rho) {
+					improve(kk, rho);
+				} else if(rho <= rho_end) {
+					converged = true;
+				} else {
+					reduce(rho, delta, rho_end);
+					err = std::numeric_limits<float_t>::max();
+				}
+				continue;
+			}
+
+			smt::sarray<float_t, N> y;
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				y(ii) = smt::project(_y(_kopt)(ii)+s(ii), float_t(0), float_t(1));
+			}
+			const float_t fval = evaluate(y);
+			const float_t pred = -quad(_g, _H, s);
+			err(2) = err(1);
+			err(1) = err(0);
+			err(0) = std::abs(_fval(_kopt)-pred-fval);
+			const float_t ratio = (pred > float_t(0))? (_fval(_kopt)-fval)/pred : float_t(-1);
+
+			if(ratio <= float_t(0.1)) {
+				delta = std::min(float_t(0.5)*delta, snorm);
+			} else if(ratio <= float_t(0.7)) {
+				delta = std::max(float_t(0.5)*delta, snorm);
+			} else {
+				delta = std::max(float_t(0.5)*delta, float_t(2)*snorm);
+			}
+			if(delta <= float_t(1.5)*rho) {
+				delta = rho;
+			}
+
+			replace(y, fval, s, delta);
+
+			if(ratio < float_t(0.1)) {
+				const std::size_t kk = farthest();
+				if(dist(_y(kk), _y(_kopt)) > float_t(2)*delta) {
+					if(model()) {
+						improve(kk, rho);
+					} else {
+						rebuild(rho);
+					}
+				} else if(std::max(delta, snorm) <= rho) {
+					if(rho <= rho_end) {
+						converged = true;
+					} else {
+						reduce(rho, delta, rho_end);
+						err = std::numeric_limits<float_t>::max();
+					}
+				}
+			}
+		}
+
+		return converged;
+	}
+
+	smt::sarray<float_t, N> operator()() const {
+		return point(_y(_kopt));
+	}
+
+	std::size_t iter() const {
+		return _iter;
+	}
+
+	std::size_t f_calls() const {
+		return _f_calls;
+	}
+
+	float_t fval() const {
+		return _fval(_kopt);
+	}
+
+	~sTrustRegion() {
+	}
+
+private:
+	static constexpr std::size_t M = (N+1)*(N+2)/2;
+
+	const float_t _rho_beg;
+	const function_t& _function;
+	smt::sarray<float_t, N> _lower;
+	smt::sarray<float_t, N> _upper;
+
+	// interpolation points in the unit box and their cost function values
+	smt::sarray<smt::sarray<float_t, N>, M> _y;
+	smt::sarray<float_t, M> _fval;
+	std::size_t _kopt;
+
+	// quadratic model around the best interpolation point, and the LU
+	// decomposition of the interpolation matrix in scaled coordinates
+	// (y-_y(_kopt))/_scale
+	smt::sarray<float_t, N> _g;
+	smt::sarray<smt::sarray<float_t, N>, N> _H;
+	smt::sarray<smt::sarray<float_t, M>, M> _LU;
+	smt::sarray<std::size_t, M> _perm;
+	float_t _scale;
+
+	std::size_t _iter;
+	std::size_t _f_calls;
+
+	smt::sarray<float_t, N> point(const smt::sarray<float_t, N>& y) const {
+		smt::sarray<float_t, N> x;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			x(ii) = _lower(ii)+y(ii)*(_upper(ii)-_lower(ii));
+		}
+
+		return x;
+	}
+
+	static float_t dist(const smt::sarray<float_t, N>& y1, const smt::sarray<float_t, N>& y2) {
+		float_t d = 0;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			d = std::max(d, std::abs(y1(ii)-y2(ii)));
+		}
+
+		return d;
+	}
+
+	float_t evaluate(const smt::sarray<float_t, N>& y) {
+		++_f_calls;
+
+		return _function(point(y));
+	}
+
+	// constant, linear, pure quadratic and mixed quadratic monomials
+	static smt::sarray<float_t, M> basis(const smt::sarray<float_t, N>& s) {
+		smt::sarray<float_t, M> phi;
+		phi(0) = 1;
+		std::size_t kk = 1;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			phi(kk++) = s(ii);
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			phi(kk++) = float_t(0.5)*s(ii)*s(ii);
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			for(std::size_t jj = ii+1; jj < N; ++jj) {
+				phi(kk++) = s(ii)*s(jj);
+			}
+		}
+
+		return phi;
+	}
+
+	// gradient and Hessian of the quadratic polynomial with the given
+	// coefficients in scaled coordinates
+	void coefficients(const smt::sarray<float_t, M>& c, smt::sarray<float_t, N>& g, smt::sarray<smt::sarray<float_t, N>, N>& H) const {
+		std::size_t kk = 1;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			g(ii) = c(kk++)/_scale;
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			H(ii)(ii) = c(kk++)/(_scale*_scale);
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			for(std::size_t jj = ii+1; jj < N; ++jj) {
+				H(ii)(jj) = c(kk++)/(_scale*_scale);
+				H(jj)(ii) = H(ii)(jj);
+			}
+		}
+	}
+
+	static float_t quad(const smt::sarray<float_t, N>& g, const smt::sarray<smt::sarray<float_t, N>, N>& H, const smt::sarray<float_t, N>& s) {
+		float_t q = 0;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			float_t Hs = 0;
+			for(std::size_t jj = 0; jj < N; ++jj) {
+				Hs += H(ii)(jj)*s(jj);
+			}
+			q += s(ii)*(g(ii)+float_t(0.5)*Hs);
+		}
+
+		return q;
+	}
+
+	// Quadratic interpolant around the best point. Returns false if the
+	// interpolation points are not poised.
+	bool model() {
+		for(std::size_t kk = 0; kk < M; ++kk) {
+			if(_fval(kk) < _fval(_kopt)) {
+				_kopt = kk;
+			}
+		}
+		_scale = 0;
+		for(std::size_t kk = 0; kk < M; ++kk) {
+			_scale = std::max(_scale, dist(_y(kk), _y(_kopt)));
+		}
+		if(_scale <= float_t(0)) {
+			return false;
+		}
+
+		// LU decomposition of the interpolation matrix with partial pivoting
+		for(std::size_t kk = 0; kk < M; ++kk) {
+			smt::sarray<float_t, N> s;
+			for(std::size_t ii = 0; ii < N; ++ii) {
+				s(ii) = (_y(kk)(ii)-_y(_kopt)(ii))/_scale;
+			}
+			_LU(kk) = basis(s);
+			_perm(kk) = kk;
+		}
+		for(std::size_t ll = 0; ll < M; ++ll) {
+			std::size_t pp = ll;
+			for(std::size_t kk = ll+1; kk < M; ++kk) {
+				if(std::abs(_LU(kk)(ll)) > std::abs(_LU(pp)(ll))) {
+					pp = kk;
+				}
+			}
+			if(std::abs(_LU(pp)(ll)) < std::sqrt(std::numeric_limits<float_t>::epsilon())) {
+				return false;
+			}
+			std::swap(_LU(pp), _LU(ll));
+			std::swap(_perm(pp), _perm(ll));
+			const float_t* u = _LU(ll).begin();
+			const float_t r = float_t(1)/u[ll];
+			for(std::size_t kk = ll+1; kk < M; ++kk) {
+				float_t* l = _LU(kk).begin();
+				const float_t a = l[ll]*r;
+				l[ll] = a;
+				for(std::size_t jj = ll+1; jj < M; ++jj) {
+					l[jj] -= a*u[jj];
+				}
+			}
+		}
+
+		smt::sarray<float_t, M> b;
+		for(std::size_t kk = 0; kk < M; ++kk) {
+			b(kk) = _fval(kk)-_fval(_kopt);
+		}
+		coefficients(solve(b), _g, _H);
+
+		return true;
+	}
+
+	// Coefficients of the polynomial taking the given values at the
+	// interpolation points. The unit vectors yield the Lagrange polynomials.
+	smt::sarray<float_t, M> solve(const smt::sarray<float_t, M>& b) const {
+		smt::sarray<float_t, M> c;
+		for(std::size_t ii = 0; ii < M; ++ii) {
+			c(ii) = b(_perm(ii));
+			for(std::size_t jj = 0; jj < ii; ++jj) {
+				c(ii) -= _LU(ii)(jj)*c(jj);
+			}
+		}
+		for(std::size_t ii = M; ii-- > 0;) {
+			for(std::size_t jj = ii+1; jj < M; ++jj) {
+				c(ii) -= _LU(ii)(jj)*c(jj);
+			}
+			c(ii) /= _LU(ii)(ii);
+		}
+
+		return c;
+	}
+
+	// Values of all Lagrange polynomials at the given step from the best point,
+	// which solve the transposed interpolation system.
+	smt::sarray<float_t, M> lagrange(const smt::sarray<float_t, N>& s) const {
+		smt::sarray<float_t, N> t;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			t(ii) = s(ii)/_scale;
+		}
+		smt::sarray<float_t, M> w = basis(t);
+		for(std::size_t ii = 0; ii < M; ++ii) {
+			for(std::size_t jj = 0; jj < ii; ++jj) {
+				w(ii) -= _LU(jj)(ii)*w(jj);
+			}
+			w(ii) /= _LU(ii)(ii);
+		}
+		for(std::size_t ii = M; ii-- > 0;) {
+			for(std::size_t jj = ii+1; jj < M; ++jj) {
+				w(ii) -= _LU(jj)(ii)*w(jj);
+			}
+		}
+		smt::sarray<float_t, M> l;
+		for(std::size_t ii = 0; ii < M; ++ii) {
+			l(_perm(ii)) = w(ii);
+		}
+
+		return l;
+	}
+
+	std::size_t farthest() const {
+		std::size_t kk = _kopt;
+		float_t dmax = 0;
+		for(std::size_t ll = 0; ll < M; ++ll) {
+			const float_t d = dist(_y(ll), _y(_kopt));
+			if(d > dmax) {
+				kk = ll;
+				dmax = d;
+			}
+		}
+
+		return kk;
+	}
+
+	// Interpolation points along the coordinate axes and in the coordinate
+	// planes around the best point, with steps pointing into the box.
+	void rebuild(const float_t& rho) {
+		const smt::sarray<float_t, N> y0 = _y(_kopt);
+		const float_t f0 = _fval(_kopt);
+		smt::sarray<float_t, N> h;
+		_y(0) = y0;
+		_fval(0) = f0;
+		_kopt = 0;
+		std::size_t kk = 1;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			float_t h2;
+			if(y0(ii)+rho > float_t(1)) {
+				h(ii) = -rho;
+				h2 = -2*rho;
+			} else if(y0(ii)-rho < float_t(0)) {
+				h(ii) = rho;
+				h2 = 2*rho;
+			} else {
+				h(ii) = rho;
+				h2 = -rho;
+			}
+			_y(kk) = y0;
+			_y(kk)(ii) += h(ii);
+			_fval(kk) = evaluate(_y(kk));
+			++kk;
+			_y(kk) = y0;
+			_y(kk)(ii) += h2;
+			_fval(kk) = evaluate(_y(kk));
+			++kk;
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			for(std::size_t jj = ii+1; jj < N; ++jj) {
+				_y(kk) = y0;
+				_y(kk)(ii) += h(ii);
+				_y(kk)(jj) += h(jj);
+				_fval(kk) = evaluate(_y(kk));
+				++kk;
+			}
+		}
+	}
+
+	// Replaces the given interpolation point by the point maximising the modulus
+	// of its Lagrange polynomial on a grid with three steps per variable in the
+	// trust region, which is sufficient for well-poisedness up to a constant
+	// factor. At a bound, the grid is refined towards the interior.
+	void improve(const std::size_t& kk, const float_t& rho) {
+		smt::sarray<float_t, N> lo;
+		smt::sarray<float_t, N> hi;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			lo(ii) = std::max(-rho, -_y(_kopt)(ii));
+			hi(ii) = std::min(rho, float_t(1)-_y(_kopt)(ii));
+			if(lo(ii) >= float_t(0)) {
+				lo(ii) = float_t(0.5)*hi(ii);
+			} else if(hi(ii) <= float_t(0)) {
+				hi(ii) = float_t(0.5)*lo(ii);
+			}
+		}
+		smt::sarray<float_t, M> e = 0;
+		e(kk) = 1;
+		const smt::sarray<float_t, M> c = solve(e);
+		smt::sarray<float_t, N> g;
+		smt::sarray<smt::sarray<float_t, N>, N> H;
+		coefficients(c, g, H);
+
+		std::size_t points = 1;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			points *= 3;
+		}
+		smt::sarray<float_t, N> smax = 0;
+		float_t lmax = -1;
+		for(std::size_t pp = 1; pp < points; ++pp) {
+			smt::sarray<float_t, N> s;
+			for(std::size_t ii = 0, code = pp; ii < N; ++ii, code /= 3) {
+				s(ii) = (code%3 == 0)? float_t(0) : ((code%3 == 1)? lo(ii) : hi(ii));
+			}
+			const float_t l = std::abs(c(0)+quad(g, H, s));
+			if(l > lmax) {
+				smax = s;
+				lmax = l;
+			}
+		}
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			_y(kk)(ii) = smt::project(_y(_kopt)(ii)+smax(ii), float_t(0), float_t(1));
+		}
+		_fval(kk) = evaluate(_y(kk));
+	}
+
+	// Includes the new point in the interpolation set by replacing the point
+	// with the largest Lagrange polynomial value, weighted by its distance.
+	void replace(const smt::sarray<float_t, N>& y, const float_t& fval, const smt::sarray<float_t, N>& s, const float_t& delta) {
+		const smt::sarray<float_t, N> ybest = (fval < _fval(_kopt))? y : _y(_kopt);
+		const smt::sarray<float_t, M> l = lagrange(s);
+		std::size_t kk = _kopt;
+		float_t wmax = -1;
+		for(std::size_t ll = 0; ll < M; ++ll) {
+			if(ll != _kopt) {
+				const float_t d = smt::pow2(dist(_y(ll), ybest)/delta);
+				const float_t w = std::abs(l(ll))*std::max(float_t(1), d*d);
+				if(w > wmax) {
+					kk = ll;
+					wmax = w;
+				}
+			}
+		}
+		_y(kk) = y;
+		_fval(kk) = fval;
+		if(fval < _fval(_kopt)) {
+			_kopt = kk;
+		}
+	}
+
+	void reduce(float_t& rho, float_t& delta, const float_t& rho_end) const {
+		const float_t ratio = rho/rho_end;
+		const float_t rho_old = rho;
+		if(ratio <= float_t(16)) {
+			rho = rho_end;
+		} else if(ratio <= float_t(250)) {
+			rho = std::sqrt(ratio)*rho_end;
+		} else {
+			rho = float_t(0.1)*rho;
+		}
+		delta = std::max(float_t(0.5)*rho_old, rho);
+	}
+
+	// Minimiser of the quadratic g's+s'Hs/2 in the box [lo, hi] containing the
+	// origin, which is the best stationary point over all faces of the box
+	// where the reduced Hessian is positive definite.
+	static smt::sarray<float_t, N> minquad(const smt::sarray<float_t, N>& g, const smt::sarray<smt::sarray<float_t, N>, N>& H, const smt::sarray<float_t, N>& lo, const smt::sarray<float_t, N>& hi) {
+		smt::sarray<float_t, N> smin = 0;
+		float_t qmin = 0;
+
+		std::size_t faces = 1;
+		for(std::size_t ii = 0; ii < N; ++ii) {
+			faces *= 3;
+		}
+		for(std::size_t ff = 0; ff < faces; ++ff) {
+			// each variable is either free or fixed at its lower or upper bound
+			smt::sarray<std::size_t, N> state;
+			smt::sarray<std::size_t, N> idx;
+			std::size_t nfree = 0;
+			smt::sarray<float_t, N> s = 0;
+			for(std::size_t ii = 0, code = ff; ii < N; ++ii, code /= 3) {
+				state(ii) = code%3;
+				if(state(ii) == 0) {
+					idx(nfree++) = ii;
+				} else {
+					s(ii) = (state(ii) == 1)? lo(ii) : hi(ii);
+				}
+			}
+
+			if(nfree > 0) {
+				// Cholesky factorisation of the reduced Hessian
+				smt::sarray<smt::sarray<float_t, N>, N> L = 0;
+				smt::sarray<float_t, N> b;
+				bool pd = true;
+				for(std::size_t ii = 0; ii < nfree && pd; ++ii) {
+					b(ii) = -g(idx(ii));
+					for(std::size_t jj = 0; jj < N; ++jj) {
+						if(state(jj) != 0) {
+							b(ii) -= H(idx(ii))(jj)*s(jj);
+						}
+					}
+					for(std::size_t jj = 0; jj <= ii; ++jj) {
+						float_t a = H(idx(ii))(idx(jj));
+						for(std::size_t kk = 0; kk < jj; ++kk) {
+							a -= L(ii)(kk)*L(jj)(kk);
+						}
+						if(jj == ii) {
+							if(a <= float_t(0)) {
+								pd = false;
+							} else {
+								L(ii)(ii) = std::sqrt(a);
+							}
+						} else {
+							L(ii)(jj) = a/L(jj)(jj);
+						}
+					}
+				}
+				if(! pd) {
+					continue;
+				}
+				for(std::size_t ii = 0; ii < nfree; ++ii) {
+					for(std::size_t kk = 0; kk < ii; ++kk) {
+						b(ii) -= L(ii)(kk)*b(kk);
+					}
+					b(ii) /= L(ii)(ii);
+				}
+				bool feasible = true;
+				for(std::size_t ii = nfree; ii-- > 0;) {
+					for(std::size_t kk = ii+1; kk < nfree; ++kk) {
+						b(ii) -= L(kk)(ii)*b(kk);
+					}
+					b(ii) /= L(ii)(ii);
+					const std::size_t jj = idx(ii);
+					if(b(ii) < lo(jj) || b(ii) > hi(jj)) {
+						feasible = false;
+					}
+					s(jj) = b(ii);
+				}
+				if(! feasible) {
+					continue;
+				}
+				if(nfree == N) {
+					// interior minimiser of a convex quadratic
+					return s;
+				}
+			}
+
+			const float_t q = quad(g, H, s);
+			if(q < qmin) {
+				smin = s;
+				qmin = q;
+			}
+		}
+
+		return smin;
+	}
+};
+
+} // smt
+
+#endif // _TRUSTREGION_H
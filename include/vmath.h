@@ -0,0 +1,339 @@
+//
+// Copyright (c) 2016 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _VMATH_H
+#define _VMATH_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "chebychev.h"
+
+namespace smt {
+
+//
+// Elementary functions for the inner loops of the cost functions. If SMT_VMATH
+// is defined, see the CMake option of the same name, they are evaluated by the
+// polynomial kernels below, which are free of branches and of calls into libm,
+// such that the compiler may inline them and vectorise the loops over shells
+// or voxels on toolchains whose libm is not vectorised. Otherwise they forward
+// to libm, which glibc (version 2.35 or later) vectorises under -Ofast. The
+// maximum errors in units in the last place (ULP) of the kernels, measured
+// against the long double functions of libm, are
+//
+//            float     double
+//   vexp     2 ULP     2.5 ULP   x clamped to [-87, 88] and [-708, 709]
+//   vlog     2 ULP     2.5 ULP   x positive and normal
+//   verf     4 ULP     4.5 ULP
+//   vsqrt    0.5 ULP   0.5 ULP   hardware square root
+//
+
+#ifdef SMT_VMATH
+
+// Exponential function. With n = round(x/log(2)) and log(2) split into a head
+// with trailing zero bits and a tail (Cody and Waite), r = x-n*log2_hi is exact
+// and c = n*log2_lo is small, such that exp(x) = 2^n*exp(r)*exp(-c) with
+// |r| <= log(2)/2. The factor exp(r) is given by the rational approximation of
+// fdlibm in terms of a minimax polynomial in r^2, exp(-c)
+// by 1-c+c^2/2, and 2^n is assembled in the exponent bits. The tail enters as
+// a factor rather than as r-c, which -ffast-math would reassociate into
+// x-n*log(2) with the rounded constant.
+
+inline float vexp(float x) {
+	const float ln2_hi = 6.93145751953125e-1f;
+	const float ln2_lo = 1.42860676533018704e-6f;
+
+	x = std::min(std::max(x, -87.0f), 88.0f);
+	const float t = 1.44269504088896340736f*x;
+	const std::int32_t n = std::int32_t(t+((t < 0.0f)? -0.5f : 0.5f));
+	const float r = x-n*ln2_hi;
+	const float c = n*ln2_lo;
+	const float z = r*r;
+	const float q = r-z*(1.66666597127914428711e-1f+z*(-2.76673319935798645020e-3f));
+	const float p = 1.0f-((r*q)/(q-2.0f)-r);
+	const std::int32_t bits = (n+127) << 23;
+	float scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+
+	return p*scale*(1.0f-c*(1.0f-0.5f*c));
+}
+
+inline double vexp(double x) {
+	const double ln2_hi = 6.93147180369123816490e-1;
+	const double ln2_lo = 1.90821492927058770002e-10;
+
+	x = std::min(std::max(x, -708.0), 709.0);
+	const double t = 1.44269504088896340736*x;
+	const std::int32_t n = std::int32_t(t+((t < 0.0)? -0.5 : 0.5));
+	const double r = x-n*ln2_hi;
+	const double c = n*ln2_lo;
+	const double z = r*r;
+	const double q = r-z*(1.66666666666666019037e-1+z*(-2.77777777770155933842e-3+z*(6.61375632143793436117e-5+
+			z*(-1.65339022054652515390e-6+z*4.13813679705723846039e-8))));
+	const double p = 1.0-((r*q)/(q-2.0)-r);
+	const std::int64_t bits = (std::int64_t(n)+1023) << 52;
+	double scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+
+	return p*scale*(1.0-c*(1.0-0.5*c));
+}
+
+// Natural logarithm. With x = 2^e*m, sqrt(2)/2 <= m < sqrt(2), f = m-1 and
+// s = f/(2+f), one obtains log(x) = e*log(2)+log(1+f), where log(1+f) =
+// 2*atanh(s) is given by its Taylor series in s, arranged as in fdlibm. The
+// exponent e is converted to floating point by placing its bits in the
+// mantissa of 2^23 or 2^52, which avoids integer conversions that SSE2 lacks.
+// Zero and negative arguments yield -inf and NaN respectively, as with libm.
+
+inline float vlog(float x) {
+	const float ln2_hi = 6.93145751953125e-1f;
+	const float ln2_lo = 1.42860676533018704e-6f;
+
+	std::uint32_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+	const std::uint32_t ebits = (bits >> 23) | 0x4b000000u;
+	bits = (bits & 0x007fffffu) | 0x3f800000u;
+	float e, m;
+	std::memcpy(&e, &ebits, sizeof(e));
+	std::memcpy(&m, &bits, sizeof(m));
+	e -= 8388608.0f+127.0f;
+	const bool hi = m > 1.41421356237309504880f;
+	m = (hi)? 0.5f*m : m;
+	e = (hi)? e+1.0f : e;
+	const float f = m-1.0f;
+	const float s = f/(2.0f+f);
+	const float z = s*s;
+	float R = 2.0f/11.0f;
+	R = R*z+2.0f/9.0f;
+	R = R*z+2.0f/7.0f;
+	R = R*z+2.0f/5.0f;
+	R = R*z+2.0f/3.0f;
+	R *= z;
+	const float hfsq = 0.5f*f*f;
+	const float y = e*ln2_hi-((hfsq-(s*(hfsq+R)+e*ln2_lo))-f);
+
+	return (x > 0.0f)? y : (x == 0.0f)? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::quiet_NaN();
+}
+
+inline double vlog(double x) {
+	const double ln2_hi = 6.93147180369123816490e-1;
+	const double ln2_lo = 1.90821492927058770002e-10;
+
+	std::uint64_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+	const std::uint64_t ebits = (bits >> 52) | 0x4330000000000000ull;
+	bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+	double e, m;
+	std::memcpy(&e, &ebits, sizeof(e));
+	std::memcpy(&m, &bits, sizeof(m));
+	e -= 4503599627370496.0+1023.0;
+	const bool hi = m > 1.41421356237309504880;
+	m = (hi)? 0.5*m : m;
+	e = (hi)? e+1.0 : e;
+	const double f = m-1.0;
+	const double s = f/(2.0+f);
+	const double z = s*s;
+	double R = 2.0/21.0;
+	R = R*z+2.0/19.0;
+	R = R*z+2.0/17.0;
+	R = R*z+2.0/15.0;
+	R = R*z+2.0/13.0;
+	R = R*z+2.0/11.0;
+	R = R*z+2.0/9.0;
+	R = R*z+2.0/7.0;
+	R = R*z+2.0/5.0;
+	R = R*z+2.0/3.0;
+	R *= z;
+	const double hfsq = 0.5*f*f;
+	const double y = e*ln2_hi-((hfsq-(s*(hfsq+R)+e*ln2_lo))-f);
+
+	return (x > 0.0)? y : (x == 0.0)? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+}
+
+// Error function. For |x| < 2, erf(x)/x is approximated by a truncated
+// Chebyshev series in x^2, and beyond by erf(x) = 1-exp(-x^2)*g(x), where
+// g(x) = exp(x^2)*erfc(x) is approximated by a truncated Chebyshev series in
+// 1/x on [2, 4] and [2, 6] for single and double precision, respectively.
+// Above these bounds, erf(x) rounds to one. Both branches are evaluated and
+// the result is selected, which keeps the function free of branches.
+
+inline float verf(float x) {
+	const std::array<float, 11> A = {
+			5.20700909206864824046e-9f,
+			-5.89910153129584343908e-8f,
+			6.11324357843476469707e-7f,
+			-5.74925655803568483505e-6f,
+			4.86209844323190482829e-5f,
+			-3.65863968584808644649e-4f,
+			2.42079952243346366289e-3f,
+			-1.39162712647221876825e-2f,
+			6.89948306898315662466e-2f,
+			-3.01071073386594942471e-1f,
+			1.48311056408480358189e0f};
+	const std::array<float, 6> B = {
+			2.43394017768665053605e-7f,
+			4.10196946343831552004e-6f,
+			1.37106355559657456330e-5f,
+			-1.43753551413291959081e-3f,
+			-5.92120625684623750074e-2f,
+			3.95261994214128074830e-1f};
+
+	const float a = std::abs(x);
+	const float a0 = std::min(a, 2.0f);
+	const float a1 = std::min(std::max(a, 2.0f), 4.0f);
+	const float y0 = a0*smt::chebeval(0.5f*a0*a0-1.0f, A);
+	const float y1 = 1.0f-vexp(-a1*a1)*smt::chebeval(3.0f-8.0f/a1, B);
+	const float y = (a < 2.0f)? y0 : y1;
+
+	return (x < 0.0f)? -y : y;
+}
+
+inline double verf(double x) {
+	const std::array<double, 18> A = {
+			-2.88742612228494535432e-17,
+			5.25481371547091867737e-16,
+			-9.04400198538174714147e-15,
+			1.46732984799108491851e-13,
+			-2.23615501883268427275e-12,
+			3.18811350664917497475e-11,
+			-4.23297587996554326810e-10,
+			5.20700909206864824046e-9,
+			-5.89910153129584343908e-8,
+			6.11324357843476469707e-7,
+			-5.74925655803568483505e-6,
+			4.86209844323190482829e-5,
+			-3.65863968584808644649e-4,
+			2.42079952243346366289e-3,
+			-1.39162712647221876825e-2,
+			6.89948306898315662466e-2,
+			-3.01071073386594942471e-1,
+			1.48311056408480358189e0};
+	const std::array<double, 17> B = {
+			-5.31641286113996473093e-17,
+			-4.67653785950335791727e-16,
+			-2.06678851556901091497e-15,
+			5.51495378985736111708e-15,
+			1.95132043102746599116e-13,
+			1.86553715700260123666e-12,
+			7.77382979196873657541e-12,
+			-4.97033718974980557138e-11,
+			-1.22849673563464724885e-9,
+			-1.06353659886595404083e-8,
+			-1.31973277470192197231e-8,
+			1.01083067565480189348e-6,
+			1.55199104194541403563e-5,
+			6.32409353665862735216e-5,
+			-2.45750137337796717684e-3,
+			-8.13737953378271577662e-2,
+			3.53056235872676404736e-1};
+
+	const double a = std::abs(x);
+	const double a0 = std::min(a, 2.0);
+	const double a1 = std::min(std::max(a, 2.0), 6.0);
+	const double y0 = a0*smt::chebeval(0.5*a0*a0-1.0, A);
+	const double y1 = 1.0-vexp(-a1*a1)*smt::chebeval(2.0-6.0/a1, B);
+	const double y = (a < 2.0)? y0 : y1;
+
+	return (x < 0.0)? -y : y;
+}
+
+#else
+
+inline float vexp(float x) {
+	return std::exp(x);
+}
+
+inline double vexp(double x) {
+	return std::exp(x);
+}
+
+inline float vlog(float x) {
+	return std::log(x);
+}
+
+inline double vlog(double x) {
+	return std::log(x);
+}
+
+inline float verf(float x) {
+	return std::erf(x);
+}
+
+inline double verf(double x) {
+	return std::erf(x);
+}
+
+#endif // SMT_VMATH
+
+// Square root, which compiles to the correctly rounded instruction of the
+// target and is provided for completeness.
+
+inline float vsqrt(float x) {
+	return std::sqrt(x);
+}
+
+inline double vsqrt(double x) {
+	return std::sqrt(x);
+}
+
+// Elementwise evaluation over arrays such as smt::darray or smt::sarray, where
+// the loops may be vectorised by the compiler.
+
+template <typename array_t>
+void vexp(const array_t& x, array_t& y) {
+	for(std::size_t ii = 0; ii < y.size(); ++ii) {
+		y[ii] = vexp(x[ii]);
+	}
+}
+
+template <typename array_t>
+void vlog(const array_t& x, array_t& y) {
+	for(std::size_t ii = 0; ii < y.size(); ++ii) {
+		y[ii] = vlog(x[ii]);
+	}
+}
+
+template <typename array_t>
+void verf(const array_t& x, array_t& y) {
+	for(std::size_t ii = 0; ii < y.size(); ++ii) {
+		y[ii] = verf(x[ii]);
+	}
+}
+
+template <typename array_t>
+void vsqrt(const array_t& x, array_t& y) {
+	for(std::size_t ii = 0; ii < y.size(); ++ii) {
+		y[ii] = vsqrt(x[ii]);
+	}
+}
+
+} // smt
+
+#endif // _VMATH_H
@@ -0,0 +1,248 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#ifndef _VOXELMAJOR_H
+#define _VOXELMAJOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cartesianrange.h"
+#include "darray.h"
+#include "debug.h"
+#include "env.h"
+#include "nifti.h"
+#include "parfor.h"
+
+namespace smt {
+
+// Voxel-major copy of a 4-D image, restricted to the foreground voxels, such
+// that the measurements of a voxel are contiguous in memory. NIfTI images are
+// stored volume-major, thus gathering the measurements of a voxel from the
+// image touches one cache line per measurement. The image is transposed in
+// blocks of adjacent voxels, which are distributed over the threads of
+// smt::parfor.
+//
+// The copy can be persisted in a sidecar file, which is reused by later runs
+// as long as the image file (size and modification time), the image
+// dimensions and the foreground voxels are unchanged, and is rebuilt
+// otherwise.
+
+template <typename float_t>
+class voxelmajor {
+public:
+	voxelmajor():
+			_dims{0, 0, 0, 0},
+			_rows(),
+			_data() {
+	}
+
+	template <typename mask_t>
+	voxelmajor(const smt::inifti<float_t, 4>& input, const smt::inifti<mask_t, 3>& mask, const unsigned int& nthreads):
+			_dims{input.size(0), input.size(1), input.size(2), input.size(3)},
+			_rows(foreground(input, mask)),
+			_data() {
+		transpose(input, nthreads);
+	}
+
+	template <typename mask_t>
+	voxelmajor(const smt::inifti<float_t, 4>& input, const smt::inifti<mask_t, 3>& mask, const std::string& inputname, const std::string& sidecar, const unsigned int& nthreads):
+			_dims{input.size(0), input.size(1), input.size(2), input.size(3)},
+			_rows(foreground(input, mask)),
+			_data() {
+		const header h = fingerprint(inputname);
+		if(! load(sidecar, h)) {
+			transpose(input, nthreads);
+			save(sidecar, h);
+		}
+	}
+
+	explicit operator bool() const {
+		return _dims[3] > 0;
+	}
+
+	smt::darray<float_t, 1> operator()(const std::size_t& i0, const std::size_t& i1, const std::size_t& i2) const {
+		smt::assert(0 <= i0 && i0 < _dims[0] && 0 <= i1 && i1 < _dims[1] && 0 <= i2 && i2 < _dims[2]);
+		const std::size_t row = _rows[i0+_dims[0]*(i1+_dims[1]*i2)];
+		smt::assert(row != npos);
+		smt::darray<float_t, 1> ret(_dims[3]);
+		std::copy(_data.begin()+row*_dims[3], _data.begin()+(row+1)*_dims[3], ret.begin());
+		return ret;
+	}
+
+	~voxelmajor() {
+	}
+
+private:
+	static const std::size_t npos = std::numeric_limits<std::size_t>::max();
+	static const std::size_t block = 256;
+
+	struct header {
+		char magic[8];
+		std::uint64_t dims[4];
+		std::uint64_t rows;
+		std::uint64_t bytesize;
+		std::uint64_t foreground;
+		std::uint64_t filesize;
+		std::int64_t mtime_sec;
+		std::int64_t mtime_nsec;
+	};
+
+	std::size_t _dims[4];
+	std::vector<std::size_t> _rows;
+	std::vector<float_t> _data;
+
+	template <typename mask_t>
+	static std::vector<std::size_t> foreground(const smt::inifti<float_t, 4>& input, const smt::inifti<mask_t, 3>& mask) {
+		std::vector<std::size_t> rows(input.size(0)*input.size(1)*input.size(2), npos);
+		std::size_t count = 0;
+		for(std::size_t kk = 0, ll = 0; kk < input.size(2); ++kk) {
+			for(std::size_t jj = 0; jj < input.size(1); ++jj) {
+				for(std::size_t ii = 0; ii < input.size(0); ++ii, ++ll) {
+					if((! mask) || mask(ii, jj, kk) > 0) {
+						rows[ll] = count++;
+					}
+				}
+			}
+		}
+
+		return rows;
+	}
+
+	std::size_t count() const {
+		return std::count_if(_rows.begin(), _rows.end(), [](const std::size_t& row) {
+			return row != npos;
+		});
+	}
+
+	void transpose(const smt::inifti<float_t, 4>& input, const unsigned int& nthreads) {
+		const std::size_t nvoxels = _rows.size();
+		_data.resize(count()*_dims[3]);
+		smt::parfor(smt::cartesianrange<1>((nvoxels+block-1)/block), [&](const std::size_t bb, const unsigned int = 0) {
+			const std::size_t first = bb*block;
+			const std::size_t n = std::min(block, nvoxels-first);
+			if(std::all_of(_rows.begin()+first, _rows.begin()+first+n, [](const std::size_t& row) { return row == npos; })) {
+				return;
+			}
+
+			float_t tmp[block];
+			for(std::size_t ll = 0; ll < _dims[3]; ++ll) {
+				input.read(first+nvoxels*ll, n, tmp);
+				for(std::size_t ii = 0; ii < n; ++ii) {
+					const std::size_t row = _rows[first+ii];
+					if(row != npos) {
+						_data[row*_dims[3]+ll] = tmp[ii];
+					}
+				}
+			}
+		}, nthreads, 1);
+	}
+
+	header fingerprint(const std::string& inputname) const {
+		struct stat st;
+		if(inputname == "-" || stat(inputname.c_str(), &st) != 0) {
+			smt::error("Unable to cache ‘" + inputname + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+
+		header h;
+		std::memset(&h, 0, sizeof(header));
+		std::memcpy(h.magic, "smtvmaj1", 8);
+		for(std::size_t ii = 0; ii < 4; ++ii) {
+			h.dims[ii] = _dims[ii];
+		}
+		h.rows = count();
+		h.bytesize = sizeof(float_t);
+		h.foreground = 14695981039346656037ULL;
+		for(std::size_t ii = 0; ii < _rows.size(); ++ii) {
+			if(_rows[ii] != npos) {
+				h.foreground = (h.foreground^ii)*1099511628211ULL;
+			}
+		}
+		h.filesize = st.st_size;
+		smt::mtime(st, h.mtime_sec, h.mtime_nsec);
+
+		return h;
+	}
+
+	bool load(const std::string& sidecar, const header& h) {
+		std::FILE* fin = std::fopen(sidecar.c_str(), "rb");
+		if(fin == nullptr) {
+			return false;
+		}
+
+		header tmp;
+		bool valid = std::fread(&tmp, sizeof(header), 1, fin) == 1 && std::memcmp(&tmp, &h, sizeof(header)) == 0;
+		if(valid) {
+			_data.resize(h.rows*h.dims[3]);
+			valid = std::fread(_data.data(), sizeof(float_t), _data.size(), fin) == _data.size();
+		}
+		std::fclose(fin);
+
+		if(! valid) {
+			_data.clear();
+		}
+
+		return valid;
+	}
+
+	void save(const std::string& sidecar, const header& h) const {
+		// The sidecar is written under a temporary name and renamed such that
+		// concurrent runs never read a partial file.
+
+		const std::string tmpname = sidecar + ".tmp" + std::to_string(getpid());
+		std::FILE* fout = std::fopen(tmpname.c_str(), "wb");
+		if(fout == nullptr || std::fwrite(&h, sizeof(header), 1, fout) != 1 || std::fwrite(_data.data(), sizeof(float_t), _data.size(), fout) != _data.size()) {
+			smt::error("Unable to write ‘" + sidecar + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+		if(std::fclose(fout) != 0 || std::rename(tmpname.c_str(), sidecar.c_str()) != 0) {
+			smt::error("Unable to write ‘" + sidecar + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+};
+
+template <typename float_t>
+const std::size_t voxelmajor<float_t>::npos;
+
+template <typename float_t>
+const std::size_t voxelmajor<float_t>::block;
+
+} // smt
+
+#endif // _VOXELMAJOR_H
@@ -0,0 +1,88 @@
+//
+// Copyright (c) 2018 Enrico Kaden & University College London
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _WARMSTART_H
+#define _WARMSTART_H
+
+#include <cstddef>
+#include <vector>
+
+#include "sarray.h"
+
+namespace smt {
+
+// Per-thread record of the most recent voxel estimate. The voxels of a chunk in
+// smt::parfor are processed consecutively by the same thread, with the first
+// image index running fastest, such that the previous estimate of a thread
+// usually belongs to the adjacent voxel. This estimate is made available as
+// starting point only if the voxels are indeed adjacent and the estimation
+// has converged.
+
+template <typename float_t, unsigned int N>
+class warmstart {
+public:
+	warmstart(const unsigned int& nthreads):
+			_records(nthreads) {
+	}
+
+	bool operator()(const unsigned int& tt, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk, smt::sarray<float_t, N>& x) const {
+		const record& r = _records[tt];
+		if(r.valid && r.ii+1 == ii && r.jj == jj && r.kk == kk) {
+			x = r.x;
+
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	void update(const unsigned int& tt, const std::size_t& ii, const std::size_t& jj, const std::size_t& kk, const smt::sarray<float_t, N>& x, const bool& converged) {
+		record& r = _records[tt];
+		r.valid = converged;
+		r.ii = ii;
+		r.jj = jj;
+		r.kk = kk;
+		r.x = x;
+	}
+
+	~warmstart() {
+	}
+
+private:
+	struct record {
+		bool valid = false;
+		std::size_t ii = 0;
+		std::size_t jj = 0;
+		std::size_t kk = 0;
+		smt::sarray<float_t, N> x;
+	};
+
+	std::vector<record> _records;
+};
+
+} // smt
+
+#endif // _WARMSTART_H
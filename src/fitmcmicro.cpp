@@ -24,8 +24,11 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <sstream>
 #include <string>
@@ -34,7 +37,9 @@
 #include "cartesianrange.h"
 #include "darray.h"
 #include "debug.h"
+#include "dictionary.h"
 #include "diffenc.h"
+#include "fitcache.h"
 #include "fitmcmicro.h"
 #include "fmt.h"
 #include "nifti.h"
@@ -43,7 +48,10 @@
 #include "progress.h"
 #include "ricedebias.h"
 #include "sarray.h"
+#include "solver.h"
 #include "version.h"
+#include "voxelmajor.h"
+#include "warmstart.h"
 
 static const char VERSION[] = R"(fitmcmicro)" " " STR(SMT_VERSION_STRING);
 
@@ -90,17 +98,32 @@ Usage:
   fitmcmicro --version
 
 Options:
-  --bvals <bvals>      Diffusion weighting factors (s/mm²) in FSL format
-  --bvecs <bvecs>      Diffusion gradient directions in FSL format
-  --grads <grads>      Diffusion gradients (s/mm²) in MRtrix format
-  --graddev <graddev>  Diffusion gradient deviation [default: none]
-  --mask <mask>        Foreground mask [default: none]
-  --rician <rician>    Rician noise [default: none]
-  --maxdiff <maxdiff>  Maximum diffusivity (mm²/s) [default: 3.05e-3]
-  --b0                 Model-based estimation of zero b-value signal
-  -h, --help           Help screen
-  --license            License information
-  --version            Software version
+  --bvals <bvals>              Diffusion weighting factors (s/mm²) in FSL format
+  --bvecs <bvecs>              Diffusion gradient directions in FSL format
+  --grads <grads>              Diffusion gradients (s/mm²) in MRtrix format
+  --graddev <graddev>          Diffusion gradient deviation [default: none]
+  --mask <mask>                Foreground mask [default: none]
+  --rician <rician>            Rician noise [default: none]
+  --maxdiff <maxdiff>          Maximum diffusivity (mm²/s) [default: 3.05e-3]
+  --b0                         Model-based estimation of zero b-value signal
+  --varpro                     Variable projection of zero b-value signal (with --b0)
+  --solver <solver>            Optimisation method [default: neldermead]
+  --tol <tol>                  Convergence tolerance [default: double]
+  --max-iter <max-iter>        Maximum number of iterations [default: 10000]
+  --approx                     Approximate spherical mean signal (single precision)
+  --warm                       Warm start from neighbouring voxel
+  --dict                       Dictionary-based starting point
+  --init <init>                Starting point from earlier estimates [default: none]
+  --transpose <transpose>      Voxel-major copy of input [default: none]
+  --fast                       Dictionary-based estimation without optimisation
+  --lockstep                   Lockstep estimation of multiple voxels
+  --cache <cache>              Cache of estimates (number of voxels) [default: 0]
+  --quantum <quantum>          Quantisation of cached signals [default: 0]
+  --diagnostics <diagnostics>  Solver diagnostics [default: none]
+  --precision <precision>      Floating-point precision [default: double]
+  -h, --help                   Help screen
+  --license                    License information
+  --version                    Software version
 )";
 
 template <typename float_t>
@@ -133,6 +156,26 @@ smt::inifti<float_t, 3> read_mask(std::map<std::string, docopt::value>& args) {
 	}
 }
 
+template <typename float_t>
+smt::inifti<float_t, 4> read_init(std::map<std::string, docopt::value>& args) {
+	if(args["--init"] && args["--init"].asString() != "none") {
+		return smt::inifti<float_t, 4>(args["--init"].asString());
+	} else {
+		return smt::inifti<float_t, 4>();
+	}
+}
+
+template <typename float_t>
+smt::voxelmajor<float_t> read_transpose(std::map<std::string, docopt::value>& args, const smt::inifti<float_t, 4>& input, const smt::inifti<float_t, 3>& mask, const unsigned int& nthreads) {
+	if(args["--transpose"] && args["--transpose"].asString() == "memory") {
+		return smt::voxelmajor<float_t>(input, mask, nthreads);
+	} else if(args["--transpose"] && args["--transpose"].asString() != "none") {
+		return smt::voxelmajor<float_t>(input, mask, args["<input>"].asString(), args["--transpose"].asString(), nthreads);
+	} else {
+		return smt::voxelmajor<float_t>();
+	}
+}
+
 template <typename float_t>
 std::tuple<float_t, smt::inifti<float_t, 3>> read_rician(std::map<std::string, docopt::value>& args) {
 	if(args["--rician"] && args["--rician"].asString() != "none") {
@@ -164,6 +207,74 @@ float_t read_maxdiff(std::map<std::string, docopt::value>& args) {
 	}
 }
 
+// Relative tolerance of the solvers, where ‘double’ retains the default of the
+// library and ‘single’ stops at the resolution of the single-precision output.
+// The tolerance is bounded below by 100 machine epsilons of the computation,
+// since the cost function is not resolved any finer, which matters for
+// --precision single only.
+
+template <typename float_t>
+float_t read_tol(std::map<std::string, docopt::value>& args) {
+	double tol;
+	if(args["--tol"].asString() == "double") {
+		tol = 1000*std::numeric_limits<double>::epsilon();
+	} else if(args["--tol"].asString() == "single") {
+		tol = std::numeric_limits<float>::epsilon()/100;
+	} else {
+		std::istringstream sin(args["--tol"].asString());
+		if(! (sin >> tol) || tol <= 0) {
+			smt::error("Unable to parse ‘" + args["--tol"].asString() + "’.");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	return std::max(float_t(tol), 100*std::numeric_limits<float_t>::epsilon());
+}
+
+std::size_t read_max_iter(std::map<std::string, docopt::value>& args) {
+	std::istringstream sin(args["--max-iter"].asString());
+	long int max_iter;
+	if(! (sin >> max_iter) || max_iter <= 0) {
+		smt::error("Unable to parse ‘" + args["--max-iter"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return max_iter;
+}
+
+std::size_t read_cache(std::map<std::string, docopt::value>& args) {
+	std::istringstream sin(args["--cache"].asString());
+	long int cache;
+	if(! (sin >> cache) || cache < 0) {
+		smt::error("Unable to parse ‘" + args["--cache"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return cache;
+}
+
+template <typename float_t>
+float_t read_quantum(std::map<std::string, docopt::value>& args) {
+	std::istringstream sin(args["--quantum"].asString());
+	float_t quantum;
+	if(! (sin >> quantum) || quantum < 0) {
+		smt::error("Unable to parse ‘" + args["--quantum"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return quantum;
+}
+
+smt::solver read_solver(std::map<std::string, docopt::value>& args) {
+	smt::solver method = smt::solver::neldermead;
+	if(args["--solver"] && ! smt::parse_solver(args["--solver"].asString(), method)) {
+		smt::error("Unable to parse ‘" + args["--solver"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+
+	return method;
+}
+
 template <typename float_t>
 smt::sarray<float_t, 3, 3> reshape_graddev(const smt::darray<float_t, 1>& g) {
 	smt::assert(g.size(0) == 9);
@@ -181,18 +292,11 @@ smt::sarray<float_t, 3, 3> reshape_graddev(const smt::darray<float_t, 1>& g) {
 	return G;
 }
 
-int main(int argc, const char** argv) {
-
-	typedef double float_t;
+template <typename float_t>
+int run(std::map<std::string, docopt::value>& args) {
 
 	// Input
 
-	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
-	if(args["--license"].asBool()) {
-		std::cout << LICENSE << std::endl;
-		return EXIT_SUCCESS;
-	}
-
 	const smt::inifti<float_t, 4> input(args["<input>"].asString());
 
 	const smt::diffenc<float_t> dw = read_diffenc<float_t>(args);
@@ -259,10 +363,67 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	const smt::inifti<float_t, 4> init = read_init<float_t>(args);
+	if(init) {
+		if(input.size(0) != init.size(0) || input.size(1) != init.size(1) || input.size(2) != init.size(2)) {
+			smt::error("‘" + args["<input>"].asString() + "’ and ‘" + args["--init"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(init.size(3) != 5) {
+			smt::error("‘" + args["--init"].asString() + "’ does not contain five volumes.");
+			return EXIT_FAILURE;
+		}
+		if(input.pixsize(0) != init.pixsize(0) || input.pixsize(1) != init.pixsize(1) || input.pixsize(2) != init.pixsize(2)) {
+			smt::error("The pixel sizes of ‘" + args["<input>"].asString() + "’ and ‘" + args["--init"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+		if(! input.has_equal_spatial_coords(init)) {
+			smt::error("The coordinate systems of ‘" + args["<input>"].asString() + "’ and ‘" + args["--init"].asString() + "’ do not match.");
+			return EXIT_FAILURE;
+		}
+	}
+
 	const float_t maxdiff = read_maxdiff<float_t>(args);
 
 	const bool b0 = args["--b0"].asBool();
 
+	const bool varpro = args["--varpro"].asBool();
+
+	const smt::solver method = read_solver(args);
+	if(method == smt::solver::brent && b0 && ! varpro) {
+		smt::error("--solver brent requires two model parameters and cannot be combined with --b0 unless --varpro is given.");
+		return EXIT_FAILURE;
+	}
+
+	const float_t tol = read_tol<float_t>(args);
+
+	const std::size_t max_iter = read_max_iter(args);
+
+	const bool approx = args["--approx"].asBool();
+
+	const bool warm = args["--warm"].asBool();
+
+	const bool fast = args["--fast"].asBool();
+
+	const smt::dictionary<float_t> dict = (args["--dict"].asBool() || fast)? smt::mcmicrodictionary(dw, maxdiff, b0) : smt::dictionary<float_t>();
+
+	if(init && fast) {
+		smt::error("--init cannot be combined with --fast.");
+		return EXIT_FAILURE;
+	}
+
+	const bool mixed = args["--precision"].asString() == "mixed";
+
+	smt::fitcache<float_t, 3> cache(read_cache(args), read_quantum<float_t>(args));
+	const std::uint64_t encoding = (cache)? cache.encoding(dw) : 0;
+	const smt::diffenc<float> dw_single = (mixed)? smt::diffenc<float>(dw) : smt::diffenc<float>();
+
+	const bool lockstep = args["--lockstep"].asBool();
+	if(lockstep && (graddev || b0 || ! dw.any_zero_bvalue() || method != smt::solver::neldermead || warm || fast || mixed || cache)) {
+		smt::error("--lockstep requires measurements with zero b-value and the Nelder-Mead method, and cannot be combined with --graddev, --b0, --warm, --fast, --cache or --precision mixed.");
+		return EXIT_FAILURE;
+	}
+
 	const int split = smt::is_format_string(args["<output>"].asString());
 	if(split < 0) {
 		smt::error("‘" + args["<output>"].asString() + "’ is malformed.");
@@ -278,6 +439,8 @@ int main(int argc, const char** argv) {
 	smt::onifti<float, 3> output_b0 = (split > 0)? smt::onifti<float, 3>(smt::format_string(args["<output>"].asString(), "b0"), input, input.size(0), input.size(1), input.size(2)) : smt::onifti<float, 3>();
 	smt::onifti<float, 4> output = (split > 0)? smt::onifti<float, 4>() : smt::onifti<float, 4>(smt::format_string(args["<output>"].asString()), input, input.size(0), input.size(1), input.size(2), 5);
 
+	smt::onifti<float, 4> diagnostics = (args["--diagnostics"] && args["--diagnostics"].asString() != "none")? smt::onifti<float, 4>(args["--diagnostics"].asString(), input, input.size(0), input.size(1), input.size(2), 4) : smt::onifti<float, 4>();
+
 	if(split > 0) {
 		output_intra.cal(0, 1);
 		output_diff.cal(0, maxdiff);
@@ -288,56 +451,171 @@ int main(int argc, const char** argv) {
 	const unsigned int nthreads = smt::threads();
 	const std::size_t chunk = 10;
 
-	smt::progress p{input.size(0)*input.size(1)*input.size(2), nthreads, "fitmcmicro"};
-	smt::parfor(smt::cartesianrange<3>(input.size(2), input.size(1), input.size(0)), [&](const std::size_t kk, const std::size_t jj, const std::size_t ii, const unsigned int tt = 0) {
-		if((! mask) || mask(ii, jj, kk) > 0) {
-			smt::darray<float_t, 1> input_tmp = input(ii, jj, kk, smt::slice(0, input.size(3)));
-			if(std::get<1>(rician)) {
+	const smt::voxelmajor<float_t> transposed = read_transpose<float_t>(args, input, mask, nthreads);
+
+	const auto signal = [&](const std::size_t ii, const std::size_t jj, const std::size_t kk) {
+		smt::darray<float_t, 1> input_tmp = (transposed)? transposed(ii, jj, kk) : input(ii, jj, kk, smt::slice(0, input.size(3)));
+		if(std::get<1>(rician)) {
+			for(std::size_t ll = 0; ll < input.size(3); ++ll) {
+				input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<1>(rician)(ii, jj, kk));
+			}
+		} else {
+			if(std::get<0>(rician) > float_t(0)) {
 				for(std::size_t ll = 0; ll < input.size(3); ++ll) {
-					input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<1>(rician)(ii, jj, kk));
+					input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<0>(rician));
 				}
-			} else {
-				if(std::get<0>(rician) > float_t(0)) {
-					for(std::size_t ll = 0; ll < input.size(3); ++ll) {
-						input_tmp(ll) = smt::ricedebias(input_tmp(ll), std::get<0>(rician));
+			}
+		}
+
+		return input_tmp;
+	};
+
+	const auto prior = [&](const std::size_t ii, const std::size_t jj, const std::size_t kk, smt::sarray<float_t, 3>& x) {
+		// Voxels which were masked or whose estimates lie outside the
+		// admissible range fall back to the default starting point.
+		const smt::sarray<float_t, 3> x1{init(ii, jj, kk, 0), init(ii, jj, kk, 1), init(ii, jj, kk, 4)};
+		if(x1(0) > float_t(0) && x1(0) < float_t(1) && x1(1) > float_t(0) && x1(1) < maxdiff) {
+			x = x1;
+
+			return true;
+		} else {
+			return false;
+		}
+	};
+
+	const auto store = [&](const std::size_t ii, const std::size_t jj, const std::size_t kk, const smt::sarray<float_t, 3>& fit, const smt::optinfo<float_t>& info) {
+		if(diagnostics) {
+			diagnostics(ii, jj, kk, 0) = info.iter;
+			diagnostics(ii, jj, kk, 1) = info.f_calls;
+			diagnostics(ii, jj, kk, 2) = info.converged;
+			diagnostics(ii, jj, kk, 3) = info.fval;
+		}
+		if(split > 0) {
+			output_intra(ii, jj, kk) = fit(0);
+			output_diff(ii, jj, kk) = fit(1);
+			output_extratrans(ii, jj, kk) = (float_t(1)-fit(0))*fit(1);
+			output_extramd(ii, jj, kk) = (float_t(1)-float_t(2)/float_t(3)*fit(0))*fit(1);
+			output_b0(ii, jj, kk) = fit(2);
+		} else {
+			output(ii, jj, kk, 0) = fit(0);
+			output(ii, jj, kk, 1) = fit(1);
+			output(ii, jj, kk, 2) = (float_t(1)-fit(0))*fit(1);
+			output(ii, jj, kk, 3) = (float_t(1)-float_t(2)/float_t(3)*fit(0))*fit(1);
+			output(ii, jj, kk, 4) = fit(2);
+		}
+	};
+
+	if(lockstep) {
+		// Foreground voxels are fitted in blocks, whose voxels are streamed
+		// through the lanes of smt::sNelderMeadLockstep.
+
+		const std::size_t lanes = 8;
+		const std::size_t block = 32*lanes;
+
+		std::vector<smt::sarray<std::size_t, 3>> voxels;
+		for(std::size_t kk = 0; kk < input.size(2); ++kk) {
+			for(std::size_t jj = 0; jj < input.size(1); ++jj) {
+				for(std::size_t ii = 0; ii < input.size(0); ++ii) {
+					if((! mask) || mask(ii, jj, kk) > 0) {
+						voxels.push_back(smt::sarray<std::size_t, 3>{ii, jj, kk});
+					} else {
+						store(ii, jj, kk, smt::sarray<float_t, 3>{0, 0, 0}, smt::optinfo<float_t>());
 					}
 				}
 			}
+		}
+
+		smt::progress p{voxels.size(), nthreads, "fitmcmicro"};
+		smt::parfor(smt::cartesianrange<1>((voxels.size()+block-1)/block), [&](const std::size_t bb, const unsigned int tt = 0) {
+			const std::size_t n = std::min(block, voxels.size()-bb*block);
+			std::vector<smt::darray<float_t, 1>> input_tmp;
+			input_tmp.reserve(n);
+			std::vector<smt::sarray<float_t, 3>> x0(n, smt::sarray<float_t, 3>{0, 0, 0});
+			for(std::size_t ll = 0; ll < n; ++ll) {
+				const smt::sarray<std::size_t, 3>& voxel = voxels[bb*block+ll];
+				input_tmp.push_back(signal(voxel(0), voxel(1), voxel(2)));
+				if(! (init && prior(voxel(0), voxel(1), voxel(2), x0[ll])) && dict) {
+					dict(input_tmp[ll], dw, x0[ll]);
+				}
+			}
+
+			std::vector<smt::sarray<float_t, 3>> fit;
+			std::vector<smt::optinfo<float_t>> info;
+			smt::fitmcmicrolockstep<float_t, lanes>(input_tmp, dw, x0, fit, info, maxdiff, approx, tol, tol/100, max_iter);
+			for(std::size_t ll = 0; ll < n; ++ll) {
+				const smt::sarray<std::size_t, 3>& voxel = voxels[bb*block+ll];
+				store(voxel(0), voxel(1), voxel(2), fit[ll], info[ll]);
+				p.increment(tt);
+			}
+		}, nthreads, 1);
+
+		smt::parclose(output_intra, output_diff, output_extratrans, output_extramd, output_b0, output, diagnostics);
+
+		return EXIT_SUCCESS;
+	}
+
+	smt::warmstart<float_t, 3> neighbour(nthreads);
+
+	smt::progress p{input.size(0)*input.size(1)*input.size(2), nthreads, "fitmcmicro"};
+	smt::parfor(smt::cartesianrange<3>(input.size(2), input.size(1), input.size(0)), [&](const std::size_t kk, const std::size_t jj, const std::size_t ii, const unsigned int tt = 0) {
+		if((! mask) || mask(ii, jj, kk) > 0) {
+			const smt::darray<float_t, 1> input_tmp = signal(ii, jj, kk);
 
 			const smt::diffenc<float_t> dw_tmp = (graddev)?
 					smt::diffenc<float_t>(dw, reshape_graddev(graddev(ii, jj, kk, smt::slice(0, 9)))) : dw;
 
-			const smt::sarray<float_t, 3> fit = smt::fitmcmicro(input_tmp, dw_tmp, maxdiff, b0);
-			if(split > 0) {
-				output_intra(ii, jj, kk) = fit(0);
-				output_diff(ii, jj, kk) = fit(1);
-				output_extratrans(ii, jj, kk) = (float_t(1)-fit(0))*fit(1);
-				output_extramd(ii, jj, kk) = (float_t(1)-float_t(2)/float_t(3)*fit(0))*fit(1);
-				output_b0(ii, jj, kk) = fit(2);
-			} else {
-				output(ii, jj, kk, 0) = fit(0);
-				output(ii, jj, kk, 1) = fit(1);
-				output(ii, jj, kk, 2) = (float_t(1)-fit(0))*fit(1);
-				output(ii, jj, kk, 3) = (float_t(1)-float_t(2)/float_t(3)*fit(0))*fit(1);
-				output(ii, jj, kk, 4) = fit(2);
+			smt::sarray<float_t, 3> x0{0, 0, 0};
+			if(warm) {
+				neighbour(tt, ii, jj, kk, x0);
 			}
-		} else {
-			if(split > 0) {
-				output_intra(ii, jj, kk) = 0;
-				output_diff(ii, jj, kk) = 0;
-				output_extratrans(ii, jj, kk) = 0;
-				output_extramd(ii, jj, kk) = 0;
-				output_b0(ii, jj, kk) = 0;
-			} else {
-				output(ii, jj, kk, 0) = 0;
-				output(ii, jj, kk, 1) = 0;
-				output(ii, jj, kk, 2) = 0;
-				output(ii, jj, kk, 3) = 0;
-				output(ii, jj, kk, 4) = 0;
+			const bool seeded = init && prior(ii, jj, kk, x0);
+
+			const smt::fitkey key = (cache)? cache.key(input_tmp, (graddev)? cache.encoding(dw_tmp) : encoding) : smt::fitkey();
+
+			smt::optinfo<float_t> info;
+			smt::sarray<float_t, 3> fit;
+			if(! (cache && cache.find(key, fit, info))) {
+				if(dict && ! seeded && dict(input_tmp, dw_tmp, x0, fast) && fast) {
+					fit = x0;
+				} else if(mixed && graddev) {
+					fit = smt::fitmcmicromixed(input_tmp, dw_tmp, smt::diffenc<float>(dw_tmp), x0, info, maxdiff, b0, varpro, method, approx, tol, tol/100, max_iter);
+				} else if(mixed) {
+					fit = smt::fitmcmicromixed(input_tmp, dw_tmp, dw_single, x0, info, maxdiff, b0, varpro, method, approx, tol, tol/100, max_iter);
+				} else {
+					fit = smt::fitmcmicro(input_tmp, dw_tmp, x0, info, maxdiff, b0, varpro, method, approx, tol, tol/100, max_iter);
+				}
+				if(cache) {
+					cache.insert(key, fit, info);
+				}
+			}
+			if(warm) {
+				neighbour.update(tt, ii, jj, kk, fit, info.converged);
 			}
+			store(ii, jj, kk, fit, info);
+		} else {
+			store(ii, jj, kk, smt::sarray<float_t, 3>{0, 0, 0}, smt::optinfo<float_t>());
 		}
 		p.increment(tt);
 	}, nthreads, chunk);
 
+	smt::parclose(output_intra, output_diff, output_extratrans, output_extramd, output_b0, output, diagnostics);
+
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, const char** argv) {
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	if(args["--precision"].asString() == "single") {
+		return run<float>(args);
+	} else if(args["--precision"].asString() == "double" || args["--precision"].asString() == "mixed") {
+		return run<double>(args);
+	} else {
+		smt::error("Unable to parse ‘" + args["--precision"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+}
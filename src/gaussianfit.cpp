@@ -81,10 +81,11 @@ Usage:
   gaussianfit --version
 
 Options:
-  --mask <mask>  Foreground mask [default: none]
-  -h, --help     Help screen
-  --license      License information
-  --version      Software version
+  --mask <mask>            Foreground mask [default: none]
+  --precision <precision>  Floating-point precision [default: double]
+  -h, --help               Help screen
+  --license                License information
+  --version                Software version
 )";
 
 template <typename float_t>
@@ -96,18 +97,11 @@ smt::inifti<float_t, 3> read_mask(std::map<std::string, docopt::value>& args) {
 	}
 }
 
-int main(int argc, const char** argv) {
-
-	typedef double float_t;
+template <typename float_t>
+int run(std::map<std::string, docopt::value>& args) {
 
 	// Input
 
-	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
-	if(args["--license"].asBool()) {
-		std::cout << LICENSE << std::endl;
-		return EXIT_SUCCESS;
-	}
-
 	const smt::inifti<float_t, 4> input(args["<input>"].asString());
 	if(input.size(3) < 2) {
 		smt::error("‘" + args["<input>"].asString() + "’ includes less than two volumes.");
@@ -170,5 +164,24 @@ int main(int argc, const char** argv) {
 		p.increment(tt);
 	}, nthreads, chunk);
 
+	smt::parclose(output_mean, output_std, output);
+
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, const char** argv) {
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	if(args["--precision"].asString() == "single") {
+		return run<float>(args);
+	} else if(args["--precision"].asString() == "double") {
+		return run<double>(args);
+	} else {
+		smt::error("Unable to parse ‘" + args["--precision"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+}
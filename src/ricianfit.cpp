@@ -24,8 +24,10 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <string>
 
@@ -39,6 +41,7 @@
 #include "progress.h"
 #include "ricianfit.h"
 #include "sarray.h"
+#include "solver.h"
 #include "version.h"
 
 static const char VERSION[] = R"(ricianfit)" " " STR(SMT_VERSION_STRING);
@@ -81,10 +84,12 @@ Usage:
   ricianfit --version
 
 Options:
-  --mask <mask>  Foreground mask [default: none]
-  -h, --help     Help screen
-  --license      License information
-  --version      Software version
+  --mask <mask>            Foreground mask [default: none]
+  --solver <solver>        Optimisation method, neldermead or trustregion [default: neldermead]
+  --precision <precision>  Floating-point precision [default: double]
+  -h, --help               Help screen
+  --license                License information
+  --version                Software version
 )";
 
 template <typename float_t>
@@ -96,17 +101,24 @@ smt::inifti<float_t, 3> read_mask(std::map<std::string, docopt::value>& args) {
 	}
 }
 
-int main(int argc, const char** argv) {
+smt::solver read_solver(std::map<std::string, docopt::value>& args) {
+	smt::solver method = smt::solver::neldermead;
+	if(args["--solver"] && ! smt::parse_solver(args["--solver"].asString(), method)) {
+		smt::error("Unable to parse ‘" + args["--solver"].asString() + "’.");
+		std::exit(EXIT_FAILURE);
+	}
+	if(method != smt::solver::neldermead && method != smt::solver::trustregion) {
+		smt::error("The solver ‘" + args["--solver"].asString() + "’ is not supported by ricianfit.");
+		std::exit(EXIT_FAILURE);
+	}
 
-	typedef double float_t;
+	return method;
+}
 
-	// Input
+template <typename float_t>
+int run(std::map<std::string, docopt::value>& args) {
 
-	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
-	if(args["--license"].asBool()) {
-		std::cout << LICENSE << std::endl;
-		return EXIT_SUCCESS;
-	}
+	// Input
 
 	const smt::inifti<float_t, 4> input(args["<input>"].asString());
 	if(input.size(3) < 2) {
@@ -130,6 +142,12 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	const smt::solver method = read_solver(args);
+
+	// The default tolerance of the library is not attainable in single
+	// precision, which is bounded below by 100 machine epsilons.
+	const float_t tol = std::max(float_t(1000*std::numeric_limits<double>::epsilon()), 100*std::numeric_limits<float_t>::epsilon());
+
 	const int split = smt::is_format_string(args["<output>"].asString());
 	if(split < 0) {
 		smt::error("‘" + args["<output>"].asString() + "’ is malformed.");
@@ -150,7 +168,7 @@ int main(int argc, const char** argv) {
 		if((! mask) || mask(ii, jj, kk) > 0) {
 			smt::darray<float_t, 1> input_tmp = input(ii, jj, kk, smt::slice(0, input.size(3)));
 
-			const smt::sarray<float_t, 2> fit = smt::ricianfit(input_tmp);
+			const smt::sarray<float_t, 2> fit = smt::ricianfit(input_tmp, float_t(0), method, tol, tol/100);
 			if(split > 0) {
 				output_loc(ii, jj, kk) = fit(0);
 				output_scale(ii, jj, kk) = fit(1);
@@ -170,5 +188,24 @@ int main(int argc, const char** argv) {
 		p.increment(tt);
 	}, nthreads, chunk);
 
+	smt::parclose(output_loc, output_scale, output);
+
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, const char** argv) {
+	std::map<std::string, docopt::value> args = smt::docopt(USAGE, {argv+1, argv+argc}, true, VERSION);
+	if(args["--license"].asBool()) {
+		std::cout << LICENSE << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	if(args["--precision"].asString() == "single") {
+		return run<float>(args);
+	} else if(args["--precision"].asString() == "double") {
+		return run<double>(args);
+	} else {
+		smt::error("Unable to parse ‘" + args["--precision"].asString() + "’.");
+		return EXIT_FAILURE;
+	}
+}